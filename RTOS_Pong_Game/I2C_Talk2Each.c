@@ -41,7 +41,10 @@ void I2C_InitSlave(void) {
 
     // 4) Clear any pending slave interrupts & enable in NVIC
     I2C0_SICR_R = I2C_SICR_DATAIC;      // clear data interrupt
-    NVIC_EN0_R |= (1 << INT_I2C0);      // enable I2C0 interrupt
+    // priority 0 (bits 7:5), above OS_KERNELCEILING, so with OS_BASEPRI
+    // the kernel never delays a byte; I2C0_Handler must make no OS_ calls
+    NVIC_PRI2_R = (NVIC_PRI2_R & 0xFFFFFF1F) | (0 << 5);
+    NVIC_EN0_R |= (1 << (INT_I2C0 - 16)); // enable I2C0 interrupt, IRQ 8
 
     __enable_irq();                     // global enable
 }
@@ -240,6 +240,14 @@ Reset_Handler   PROC
                 IMPORT  __main
 ;                LDR     R0, =SystemInit
 ;                BLX     R0
+                ; enable the FPU (CP10 and CP11 full access) before
+                ; the C library touches FPSCR
+                LDR     R0, =0xE000ED88     ; CPACR
+                LDR     R1, [R0]
+                ORR     R1, R1, #0x00F00000
+                STR     R1, [R0]
+                DSB
+                ISB
                 LDR     R0, =__main
                 BX      R0
                 ENDP
@@ -1,5 +1,6 @@
 // Libraries included 
 #include <stdint.h>
+#include <stdlib.h>
 #include "BSP.h"
 #include "CortexM.h"
 #include "os.h"
@@ -7,9 +8,13 @@
 #include "ball.h"
 #include "walls.h"
 #include "comm_lib.h"
+#ifdef PONG_LATENCY
+#include "oslatency.h"
+#include "UART0.h"
+#endif
 
 static bool ledPrev = false;   // Remember previous LED level
-int32_t CommSema;
+Sema_t CommSema;
 
 // Runs every 33ms to update game
 void Game_Updater(void)
@@ -21,7 +26,7 @@ void Game_Updater(void)
 
 void CommThread(void) {
     while (1) {
-        OS_Wait(&CommSema);  // Block here until signaled
+        OS_SemaWait(&CommSema);  // Block here until signaled
 
         bool level = Comm_CheckReceived();
         LED_Set(level);
@@ -40,11 +45,46 @@ void CommThread(void) {
 }
 
 void CommSignalThread(void) {
-    OS_Signal(&CommSema);
+    OS_SemaSignal(&CommSema);
 }
 
-// Idle Task
-void Idle(void){ while(1){} }
+#ifdef PONG_LATENCY
+// Sample TIMER2A's latency for one second at this priority, then send
+// min, max and mean cycles over UART0
+static void LatencyReport(uint32_t priority) {
+    OS_LatencyStats_t stats;
+
+    OS_LatencyStart(priority, 97);  // ~10 kHz, jittered
+    OS_SleepUs(1000000);
+    OS_LatencyStop();
+    OS_LatencyStats(&stats);
+    UART0_OutString("priority ");
+    UART0_OutUDec(priority);
+    UART0_OutString(": min ");
+    UART0_OutUDec(stats.min);
+    UART0_OutString(" max ");
+    UART0_OutUDec(stats.max);
+    UART0_OutString(" mean ");
+    UART0_OutUDec(stats.mean);
+    UART0_OutString(" cycles, ");
+    UART0_OutUDec(stats.count);
+    UART0_OutString(" samples\r\n");
+}
+
+// Lowest priority: alternates between priority 0, above
+// OS_KERNELCEILING like I2C0, and 5, below it, while the game runs
+void LatencyThread(void) {
+#ifdef OS_BASEPRI
+    UART0_OutString("\r\nlatency, kernel masks with BASEPRI\r\n");
+#else
+    UART0_OutString("\r\nlatency, kernel masks with PRIMASK\r\n");
+#endif
+    while (1) {
+        LatencyReport(0);
+        LatencyReport(5);
+    }
+}
+#endif
 
 // Main loop
 int main(void)
@@ -55,16 +95,23 @@ int main(void)
     BSP_Joystick_Init();  // Joystick Init
 
     Comm_Init();  // Communication Init
+#ifdef PONG_LATENCY
+    UART0_Init();  // Latency reports, 115200 baud
+#endif
 
     BSP_LCD_FillScreen(LCD_BLACK);  // LCD reset
     Paddle_Init();  // Init game functions
     Ball_Init();
     Walls_Draw();
 		Ball_ClearAll();  // Clear all balls
-		OS_InitSemaphore(&CommSema, 0);  // Start at 0 = waiting
+		OS_SemaInit(&CommSema, 0, OS_ORDER_FIFO);  // Start at 0 = waiting
 
     OS_Init();  // Set up RTOS
-    OS_AddThreads(&CommThread,&Idle,&Idle,&Idle,&Idle,&Idle);  // Add 6 threads as placeholders
+#ifdef PONG_LATENCY
+    OS_AddThreads(&CommThread,1, &LatencyThread,7, NULL,0, NULL,0, NULL,0, NULL,0);
+#else
+    OS_AddThreads(&CommThread,1, NULL,0, NULL,0, NULL,0, NULL,0, NULL,0);  // Kernel idles when CommThread blocks
+#endif
     OS_AddPeriodicEventThread(&Game_Updater, 33);  // 30 Hz game update
     OS_AddPeriodicEventThread(&CommSignalThread, 33);
 		OS_Launch(10000);  // Launch OS at counter of 10,000 clk cycles
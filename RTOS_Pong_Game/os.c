@@ -6,36 +6,309 @@
 
 #include <stdint.h>
 #include <stdlib.h> // Allows use of NULL
+#include <string.h>
 #include "os.h"
 #include "CortexM.h"
 #include "BSP.h"
-int32_t FifoSemaphore; // counts the number of valid items in the FIFO
+#include "osbench.h"
+#include "ostrace.h"
+#include "osstats.h"
+Sema_t FifoSemaphore;  // counts the number of valid items in the FIFO
 // function definitions in osasm.s
 void StartOS(void);
+void OS_WaitForInterrupt(void);  // WFI inside a kernel critical section
 
-#define NUMTHREADS  6        // maximum number of threads
+#ifndef NUMTHREADS
+#define NUMTHREADS  6        // maximum number of threads, set at compile time
+#endif
 #define NUMPERIODIC 2        // maximum number of periodic threads
 #define STACKSIZE   100      // number of 32-bit words in stack per thread
+#ifndef STACKPOOLSIZE
+#define STACKPOOLSIZE (NUMTHREADS*STACKSIZE) // words shared by OS_CreateThread
+#endif
+#define MINSTACKBYTES 256    // room for a full FPU context plus a little more
+#define NUMPRIORITIES 8      // thread priorities 0 (highest) to 7 (lowest)
+#define IDLESTACKSIZE STACKSIZE // ISRs and periodic events run on it too
+#define EVENTSTACKSIZE STACKSIZE // OS_DEFEREVENTS runs periodic events on it
+#define NUMLEGACYSEMA 8      // int32_t semaphores that can have waiters
+#define STACKPAINT  0xA5A5A5A5 // fills new stacks, what is left marks unused words
+#define EDFUTILIZATION 90    // percent of the CPU EDF threads may reserve
+#define GUARDBYTES  32       // smallest MPU region, OS_STACKGUARD places one
+                             // at the bottom of the running thread's stack
+
+#ifdef OS_CPUSTATS
+// CPU time charged to a thread or bucket, in core cycles
+typedef struct{
+  uint64_t total;      // since OS_Launch
+  uint32_t window;     // in the window now running
+  uint32_t last;       // in the last complete window
+} cpu_t;
+#endif
+
 struct tcb{
   int32_t *sp;       // pointer to stack (valid for threads not running
-  struct tcb *next;  // linked-list pointer
+  struct tcb *next;  // ready-list pointers, circular per priority,
+  struct tcb *prev;  // or wait-list pointers while blocked
    // nonzero if blocked on this semaphore
    // nonzero if this thread is sleeping
-//*FILL THIS IN****
 	int32_t *blocked;
 	uint32_t sleep;
+  uint32_t priority; // 0 is highest, raised while it holds a mutex
+  uint32_t basePriority; // priority given at creation
+  uint64_t wakeTime; // TickCount at which a sleeping thread wakes
+  struct tcb *sleepNext; // sleep list, sorted by wakeTime
+  OS_WaitList_t *waitList; // wait list of a timed wait, NULL otherwise
+  OS_WaitList_t *onList; // wait list it is in, timed or not, NULL otherwise
+  uint32_t timedOut;     // 1 if the last timed wait ran out
+  OS_Mutex_t *held;      // mutexes this thread owns, linked by nextHeld
+  OS_Mutex_t *blockedMutex; // mutex this thread waits for, NULL otherwise
+  uint32_t flagsMask;    // event flags a thread in OS_FlagsWait wants
+  uint32_t flagsOptions; // OS_FLAGS_ALL and OS_FLAGS_CLEAR
+  uint32_t flagsResult;  // flags that satisfied the wait
+#ifdef OS_EDF
+  uint32_t edf;          // 1 for an EDF thread, scheduled by deadline
+  uint32_t edfWaiting;   // sleeping until its next release
+  uint32_t period;       // ticks between releases
+  uint32_t relDeadline;  // ticks from release to deadline
+  uint32_t budget;       // ticks each job may run
+  uint32_t used;         // ticks the current job has run
+  uint64_t release;      // TickCount of the current job's release
+  uint64_t deadline;     // TickCount the current job must finish by
+  uint32_t misses;       // jobs that finished late or ran out of budget
+  uint32_t overruns;     // jobs stopped because they used their budget
+#endif
+#ifdef OS_CPUSTATS
+  cpu_t cpu;             // time on the CPU, ISRs excluded
+#endif
+  int32_t *stackBase;    // lowest word of the stack
+  uint32_t stackWords;   // size of the stack
+  void(*task)(void *);   // thread function, names the thread after a fault
+#ifdef OS_STACKGUARD
+  uint32_t guard;        // MPUBASE value that guards this stack
+#endif
 };
 typedef struct tcb tcbType;
 tcbType tcbs[NUMTHREADS];
 tcbType *RunPt;
-int32_t Stacks[NUMTHREADS][STACKSIZE];
+uint32_t NumThreads;         // tcbs[] in use
+
+// stacks requested without a buffer are carved from here, never freed
+int32_t StackPool[STACKPOOLSIZE];
+uint32_t StackPoolUsed;      // words handed out
+
+// One circular doubly linked list of ready threads per priority.
+// Bit 31-p of ReadyBitmap is set when ReadyList[p] is not empty,
+// so the highest ready priority is found with one CLZ.
+tcbType *ReadyList[NUMPRIORITIES];
+uint32_t ReadyBitmap;
+
+#ifdef OS_EDF
+// Ready EDF threads, earliest deadline first. They all run before
+// any fixed-priority thread, admission control keeps them below
+// EDFUTILIZATION percent of the CPU so the others are not starved
+tcbType *EdfList;
+uint32_t EdfUtilization;     // reserved by admitted threads, parts per million
+#endif
+
+// runs when no thread is ready, never sits in a ready list
+tcbType IdleTcb;
+int32_t IdleStack[IDLESTACKSIZE];
+
+#ifdef OS_DEFEREVENTS
+// runs released periodic events ahead of every thread but with
+// interrupts enabled, never sits in a ready list
+tcbType EventTcb;
+int32_t EventStack[EVENTSTACKSIZE];
+uint32_t EventReleased;      // bit i set while Periodic[i] waits to run
+#endif
+
+uint32_t TimeSlice;          // SysTick cycles per tick, set by OS_Launch
+uint64_t TickCount;          // ticks since OS_Launch, corrected after idle
+uint32_t TickStretch = 1;    // ticks covered by the current SysTick period
+uint32_t SysTickInterrupts;  // SysTick wakeups, TickCount/SysTickInterrupts
+                             // shows how much tickless idle saves
+
+// Absolute time in core cycles, DWT CYCCNT extended to 64 bits.
+// CYCCNT keeps counting with interrupts disabled and does not depend
+// on the time slice, so periodic releases computed from it never drift
+uint64_t CycleHigh;          // upper 32 bits
+uint32_t CycleLast;          // CYCCNT at the last read, detects the wrap
+uint32_t CyclesPerUs;        // core cycles per microsecond
+
+#ifdef OS_CPUSTATS
+#define CPUWINDOW 80000000   // cycles per utilization window, 1 s at 80 MHz
+// The switcher charges the outgoing thread for the cycles since
+// CpuStamp. ISRs move CpuStamp forward by their own length, so their
+// time goes to IsrCpu instead of the thread they interrupted
+uint32_t CpuStamp;           // CYCCNT when RunPt was last charged
+cpu_t IsrCpu;                // SysTick and ISRs that call OS_CpuIsrEnter
+#ifndef OS_DEFEREVENTS
+cpu_t EventCpu;              // periodic events, run inside SysTick
+#endif
+uint32_t IsrStart;           // CYCCNT at entry to the outermost ISR
+uint32_t IsrDepth;           // nested ISRs being timed
+uint64_t CpuLaunch;          // CycleTime at OS_Launch
+uint32_t WindowStart;        // CYCCNT when the current window began
+uint32_t WindowCycles;       // length of the last complete window
+#endif
+
+// Sleeping threads sorted by absolute wake time, earliest first,
+// so each tick only has to look at the head
+tcbType *SleepList;
+
+// wait queues lent to the int32_t semaphore API, found by address
+typedef struct{
+  int32_t *semaPt;
+  OS_WaitList_t waiters;
+} legacysema_t;
+legacysema_t LegacySema[NUMLEGACYSEMA];
+
+// Written by OS_StackFault, read with the debugger after a fault.
+// The watch window shows FaultTask as the thread function's name
+tcbType *FaultThread;        // thread that overflowed, else the one running
+void(*FaultTask)(void *);    // FaultThread's function
+uint32_t FaultOverflow;      // 1 if FaultThread overflowed its stack
+uint32_t FaultStatus;        // FAULTSTAT (CFSR) at the fault
+uint32_t FaultAddress;       // MMADDR, valid if FaultStatus bit 7 is set
+int32_t *FaultSp;            // stack pointer when the fault was taken
+
+#ifdef OS_BENCHMARK
+OS_Bench_t SchedulerBench; // cycles to select the next thread
+OS_Bench_t SwitchBench;    // cycles from switch request to an integer thread
+OS_Bench_t FpuSwitchBench; // same, when the new thread has FPU state
+OS_Bench_t SysTickBench;   // cycles spent in SysTick_Handler
+OS_Bench_t SignalBench;    // cycles with interrupts off in a signal
+OS_Bench_t MutexBench;     // cycles a thread waited in OS_MutexLock
+uint32_t SwitchStart;
+#endif
 
 typedef struct{
 	void(*Task)(void);
-	uint32_t period;
-	uint32_t counter;
+	uint32_t period;       // cycles between releases
+	uint64_t release;      // absolute cycle time of the next release
+	OS_PeriodicStats_t stats;
+	OS_Probe_t *probe;     // timed by OS_ProbeSample if not NULL
 } periodic_t;
 periodic_t Periodic[NUMPERIODIC];
+uint32_t NumPeriodic;        // Periodic[] in use
+
+#ifdef OS_EDF
+// ******** EdfInsert ************
+// Put an EDF thread in EdfList behind every thread whose deadline
+// is the same or earlier
+// Called with interrupts disabled
+static void EdfInsert(tcbType *thread){
+  tcbType *after = NULL;
+  tcbType *pt = EdfList;
+  while((pt != NULL) && (pt->deadline <= thread->deadline)){
+    after = pt;
+    pt = pt->next;
+  }
+  thread->prev = after;
+  thread->next = pt;
+  if(after == NULL){
+    EdfList = thread;
+  } else{
+    after->next = thread;
+  }
+  if(pt != NULL){
+    pt->prev = thread;
+  }
+}
+
+// ******** EdfRemove ************
+// Take an EDF thread out of EdfList
+// Called with interrupts disabled
+static void EdfRemove(tcbType *thread){
+  if(thread->prev == NULL){
+    EdfList = thread->next;
+  } else{
+    thread->prev->next = thread->next;
+  }
+  if(thread->next != NULL){
+    thread->next->prev = thread->prev;
+  }
+}
+#endif
+
+// ******** ReadyInsert ************
+// Append a thread to the tail of its priority's ready list,
+// so it runs after the threads already waiting at that level
+// Called with interrupts disabled
+static void ReadyInsert(tcbType *thread){
+#ifdef OS_EDF
+  if(thread->edf){
+    EdfInsert(thread);
+    return;
+  }
+#endif
+  uint32_t p = thread->priority;
+  tcbType *head = ReadyList[p];
+  if(head == NULL){
+    thread->next = thread;
+    thread->prev = thread;
+    ReadyList[p] = thread;
+    ReadyBitmap |= 0x80000000>>p;
+  } else{
+    thread->next = head;
+    thread->prev = head->prev;
+    head->prev->next = thread;
+    head->prev = thread;
+  }
+}
+
+// ******** ReadyRemove ************
+// Take a thread out of its ready list when it blocks or sleeps
+// Called with interrupts disabled
+static void ReadyRemove(tcbType *thread){
+#ifdef OS_EDF
+  if(thread->edf){
+    EdfRemove(thread);
+    return;
+  }
+#endif
+  uint32_t p = thread->priority;
+  if(thread->next == thread){      // it was the only one
+    ReadyList[p] = NULL;
+    ReadyBitmap &= ~(0x80000000>>p);
+  } else{
+    thread->prev->next = thread->next;
+    thread->next->prev = thread->prev;
+    if(ReadyList[p] == thread){
+      ReadyList[p] = thread->next;
+    }
+  }
+}
+
+static void OS_Idle(void);
+static void WaitRemove(OS_WaitList_t *list, tcbType *thread);
+static tcbType *NewThread(void(*task)(void *), void *arg,
+                          int32_t *stack, uint32_t stackBytes, uint32_t priority);
+#ifdef OS_EDF
+static void EdfSleepUntilRelease(tcbType *thread);
+#endif
+#ifdef OS_DEFEREVENTS
+static void OS_EventThread(void);
+#endif
+static uint64_t CycleTime(void);
+static void PendSwitch(void);
+static tcbType *HighestReady(void);
+static void ThreadStack(tcbType *thread, int32_t *stack, uint32_t words,
+                        void(*task)(void *), void *arg);
+
+// ******** SleepInsert ************
+// Put a thread in the sleep list behind every thread that wakes
+// at the same time or earlier. Cost grows with the number of sleepers
+// but is paid once by OS_Sleep, never by the tick
+// Called with interrupts disabled
+static void SleepInsert(tcbType *thread){
+  tcbType **pt = &SleepList;
+  while((*pt != NULL) && ((*pt)->wakeTime <= thread->wakeTime)){
+    pt = &(*pt)->sleepNext;
+  }
+  thread->sleepNext = *pt;
+  *pt = thread;
+}
 
 // ******** OS_Init ************
 // Initialize operating system, disable interrupts
@@ -47,92 +320,302 @@ void OS_Init(void){
   DisableInterrupts();
   BSP_Clock_InitFastest();// set processor clock to fastest speed
   // perform any initializations needed
+  NumPeriodic = 0;
 		
 	RunPt = NULL;
 	
+	NumThreads = 0;
+	StackPoolUsed = 0;
 	for(int i =0; i < NUMTHREADS; i++){
 		tcbs[i].sp = NULL;
 		tcbs[i].next = NULL;
+		tcbs[i].prev = NULL;
+		tcbs[i].blocked = 0;
+		tcbs[i].sleep = 0;
+		tcbs[i].waitList = NULL;
+		tcbs[i].onList = NULL;
+		tcbs[i].held = NULL;
+		tcbs[i].blockedMutex = NULL;
+		tcbs[i].stackBase = NULL;
 	}
+  for(int p = 0; p < NUMPRIORITIES; p++){
+    ReadyList[p] = NULL;
+  }
+  ReadyBitmap = 0;
+  SleepList = NULL;
+#ifdef OS_EDF
+  EdfList = NULL;
+  EdfUtilization = 0;
+#endif
+  FPCCR |= 0xC0000000;    // ASPEN and LSPEN: lazy stacking of S0-S15
+  ThreadStack(&IdleTcb, IdleStack, IDLESTACKSIZE, (void(*)(void *))&OS_Idle, NULL);
+  IdleTcb.blocked = 0;
+  IdleTcb.sleep = 0;
+  IdleTcb.priority = NUMPRIORITIES;  // below every real thread
+#ifdef OS_DEFEREVENTS
+  ThreadStack(&EventTcb, EventStack, EVENTSTACKSIZE, (void(*)(void *))&OS_EventThread, NULL);
+  EventTcb.blocked = 0;
+  EventTcb.sleep = 0;
+  EventTcb.priority = 0;             // woken threads never preempt it
+  EventReleased = 0;
+#endif
+  OS_BenchInit();
+  OS_BenchReset(&SchedulerBench);
+  OS_BenchReset(&SwitchBench);
+  OS_BenchReset(&FpuSwitchBench);
+  OS_BenchReset(&SysTickBench);
+  OS_BenchReset(&SignalBench);
+  OS_BenchReset(&MutexBench);
+  DEMCR |= 0x01000000;    // TRCENA, powers the DWT
+  DWT_CTRL |= 0x00000001; // CYCCNTENA, the kernel's time base
+  CyclesPerUs = BSP_Clock_GetFreq()/1000000;
+  CycleHigh = 0;
+  CycleLast = DWT_CYCCNT;
+#ifdef OS_TRACE
+  OS_TraceInit();
+#endif
 }
 
-void SetInitialStack(int i){
-
+// ******** SetInitialStack ************
+// Build the frame PendSV and StartOS expect at the top of a stack of
+// any size: R4-R11 and EXC_RETURN below the hardware exception frame
+// Inputs: one past the highest word of the stack
+//         thread function and the argument it receives in R0
+// Outputs: initial stack pointer for the TCB
+static int32_t *SetInitialStack(int32_t *top, void(*task)(void *), void *arg){
+  int32_t *sp = (int32_t *)((uintptr_t)top & ~(uintptr_t)7); // AAPCS wants 8-byte alignment
   // **Same as Lab 2****
-	tcbs[i].sp = &Stacks[i][STACKSIZE-16]; // thread stack pointer
-  Stacks[i][STACKSIZE-1] = 0x01000000;   // thumb bit
-  Stacks[i][STACKSIZE-3] = 0x14141414;   // R14
-  Stacks[i][STACKSIZE-4] = 0x12121212;   // R12
-  Stacks[i][STACKSIZE-5] = 0x03030303;   // R3
-  Stacks[i][STACKSIZE-6] = 0x02020202;   // R2
-  Stacks[i][STACKSIZE-7] = 0x01010101;   // R1
-  Stacks[i][STACKSIZE-8] = 0x00000000;   // R0
-  Stacks[i][STACKSIZE-9] = 0x11111111;   // R11
-  Stacks[i][STACKSIZE-10] = 0x10101010;  // R10
-  Stacks[i][STACKSIZE-11] = 0x09090909;  // R9
-  Stacks[i][STACKSIZE-12] = 0x08080808;  // R8
-  Stacks[i][STACKSIZE-13] = 0x07070707;  // R7
-  Stacks[i][STACKSIZE-14] = 0x06060606;  // R6
-  Stacks[i][STACKSIZE-15] = 0x05050505;  // R5
-  Stacks[i][STACKSIZE-16] = 0x04040404;  // R4
+  sp = sp - 17;                // thread stack pointer
+  sp[16] = 0x01000000;   // thumb bit
+  sp[15] = (int32_t)(task); // PC
+  sp[14] = 0x14141414;   // R14
+  sp[13] = 0x12121212;   // R12
+  sp[12] = 0x03030303;   // R3
+  sp[11] = 0x02020202;   // R2
+  sp[10] = 0x01010101;   // R1
+  sp[9] = (int32_t)(arg); // R0
+  sp[8] = (int32_t)0xFFFFFFF9; // EXC_RETURN, thread mode, basic frame, no FPU
+  sp[7] = 0x11111111;    // R11
+  sp[6] = 0x10101010;    // R10
+  sp[5] = 0x09090909;    // R9
+  sp[4] = 0x08080808;    // R8
+  sp[3] = 0x07070707;    // R7
+  sp[2] = 0x06060606;    // R6
+  sp[1] = 0x05050505;    // R5
+  sp[0] = 0x04040404;    // R4
+  return sp;
+}
+
+// ******** ThreadStack ************
+// Paint a new stack so its high-water mark can be read later,
+// then build the initial frame at the top
+// Inputs: TCB that owns the stack
+//         lowest word of the stack and its size in words
+//         thread function and the argument it receives in R0
+static void ThreadStack(tcbType *thread, int32_t *stack, uint32_t words,
+                        void(*task)(void *), void *arg){
+  for(uint32_t i = 0; i < words; i++){
+    stack[i] = (int32_t)STACKPAINT;
+  }
+  thread->stackBase = stack;
+  thread->stackWords = words;
+  thread->task = task;
+#ifdef OS_STACKGUARD
+  // first region-aligned block inside the stack, VALID and region 0
+  thread->guard = (uint32_t)(((uintptr_t)stack + GUARDBYTES - 1) & ~(uintptr_t)(GUARDBYTES - 1)) | 0x10;
+#endif
+  thread->sp = SetInitialStack(&stack[words], task, arg);
+}
+
+// ******** NewThread ************
+// Claim a TCB and a stack and build the thread's initial frame.
+// The caller finishes the TCB and puts it in a ready list
+// Called with interrupts disabled
+// Outputs: the new thread, NULL if no TCB or pool stack is left
+static tcbType *NewThread(void(*task)(void *), void *arg,
+                          int32_t *stack, uint32_t stackBytes, uint32_t priority){
+  uint32_t words = stackBytes/4;
+  if(NumThreads >= NUMTHREADS){
+    return NULL;
+  }
+  if(stack == NULL){
+    words = (words + 1) & ~1;    // keep the next pool stack 8-byte aligned
+    if(StackPoolUsed + words > STACKPOOLSIZE){
+      return NULL;
+    }
+    stack = &StackPool[StackPoolUsed];
+    StackPoolUsed += words;
+  }
+  tcbType *thread = &tcbs[NumThreads];
+  NumThreads++;
+  ThreadStack(thread, stack, words, task, arg);
+  thread->blocked = 0;
+  thread->sleep = 0;
+  thread->waitList = NULL;
+  thread->onList = NULL;
+  thread->priority = priority;
+  thread->basePriority = priority;
+  thread->held = NULL;
+  thread->blockedMutex = NULL;
+#ifdef OS_EDF
+  thread->edf = 0;
+  thread->edfWaiting = 0;
+#endif
+  return thread;
+}
+
+//******** OS_CreateThread ***************
+// Add one main thread, before or after OS_Launch
+// Inputs: thread function, receives arg in R0
+//         arg passed to the thread
+//         stack buffer, or NULL to take stackBytes from the kernel's pool
+//         stackBytes, size of the stack (at least 256)
+//         priority, 0 is highest, 7 is lowest
+// Outputs: 1 if successful, 0 if this thread can not be added
+// Declare static stacks with OS_STACK so they are sized and aligned
+int OS_CreateThread(void(*task)(void *), void *arg,
+                    int32_t *stack, uint32_t stackBytes, uint32_t priority){
+  if((task == NULL) || (priority >= NUMPRIORITIES) || (stackBytes < MINSTACKBYTES)){
+    return 0;
+  }
+  long sr = OS_StartCritical();
+  tcbType *thread = NewThread(task, arg, stack, stackBytes, priority);
+  if(thread == NULL){
+    OS_EndCritical(sr);
+    return 0;
+  }
+  ReadyInsert(thread);
+  if((RunPt != NULL) && (HighestReady() != RunPt)){
+    PendSwitch();              // already launched and outranks the caller
+  }
+  OS_EndCritical(sr);
+  return 1;
 }
 
 //******** OS_AddThreads ***************
-// Add six main threads to the scheduler
-// Inputs: function pointers to six void/void main threads
+// Add up to six main threads to the scheduler
+// Inputs: function pointers to six void/void main threads,
+//         NULL leaves the slot unused (the kernel has its own idle thread)
+//         priority of each thread, 0 is highest, 7 is lowest
+//         threads with equal priority share the CPU round robin
 // Outputs: 1 if successful, 0 if this thread can not be added
-// This function will only be called once, after OS_Init and before OS_Launch
-int OS_AddThreads(void(*thread0)(void),
-                  void(*thread1)(void),
-                  void(*thread2)(void),
-                  void(*thread3)(void),
-                  void(*thread4)(void),
-                  void(*thread5)(void)){
-  // **similar to Lab 2. initialize as not blocked, not sleeping****
- int32_t status = StartCritical();
-// Link TCBs in a circular list:
-  tcbs[0].next = &tcbs[1];
-  tcbs[1].next = &tcbs[2];
-  tcbs[2].next = &tcbs[3];
-  tcbs[3].next = &tcbs[4];
-  tcbs[4].next = &tcbs[5];
-  tcbs[5].next = &tcbs[0];
-  
-  // Initialize each thread's stack (set blocked and sleep to 0)
-  SetInitialStack(0);Stacks[0][STACKSIZE-2] = (int32_t)(thread0);
-  tcbs[0].blocked = 0;
-  tcbs[0].sleep = 0;
-										
-  SetInitialStack(1);Stacks[1][STACKSIZE-2] = (int32_t)(thread1);
-  tcbs[1].blocked = 0;
-  tcbs[1].sleep = 0;	
-										
-  SetInitialStack(2);Stacks[2][STACKSIZE-2] = (int32_t)(thread2);
-  tcbs[2].blocked = 0;
-  tcbs[2].sleep = 0;			
-
-  SetInitialStack(3);Stacks[3][STACKSIZE-2] = (int32_t)(thread3);
-  tcbs[3].blocked = 0;
-  tcbs[3].sleep = 0;
-	
-	SetInitialStack(4);Stacks[4][STACKSIZE-2] = (int32_t)(thread4);
-  tcbs[4].blocked = 0;
-  tcbs[4].sleep = 0;
-	
-	SetInitialStack(5);Stacks[5][STACKSIZE-2] = (int32_t)(thread5);
-  tcbs[5].blocked = 0;
-  tcbs[5].sleep = 0;
-										
-  RunPt = &tcbs[0]; // first thread to run
-  EndCritical(status);
+// Each thread gets a STACKSIZE-word stack from the kernel's pool
+int OS_AddThreads(void(*thread0)(void), uint32_t p0,
+                  void(*thread1)(void), uint32_t p1,
+                  void(*thread2)(void), uint32_t p2,
+                  void(*thread3)(void), uint32_t p3,
+                  void(*thread4)(void), uint32_t p4,
+                  void(*thread5)(void), uint32_t p5){
+  void(*task[6])(void) = {thread0, thread1, thread2, thread3, thread4, thread5};
+  uint32_t priority[6] = {p0, p1, p2, p3, p4, p5};
+  for(int i = 0; i < 6; i++){
+    if(task[i] == NULL) continue;
+    // void/void threads simply ignore the argument in R0
+    if(OS_CreateThread((void(*)(void *))task[i], NULL, NULL, STACKSIZE*4, priority[i]) == 0){
+      return 0;
+    }
+  }
   return 1;               // successful
 }
 
+#ifdef OS_EDF
+//******** OS_CreateEdfThread ***************
+// Add an earliest-deadline-first thread, before or after OS_Launch.
+// Each job is released every period ticks, must finish within
+// deadline ticks and may run for budget ticks. The thread calls
+// OS_EdfWaitNext at the end of each job. Ready EDF threads run
+// before every fixed-priority thread, the one due first first
+// Inputs: thread function, receives arg in R0
+//         arg passed to the thread
+//         stack buffer, or NULL to take stackBytes from the kernel's pool
+//         stackBytes, size of the stack (at least 256)
+//         period, deadline and budget in ticks, budget <= deadline <= period
+// Outputs: 1 if admitted, 0 if it would push the EDF threads past
+//          EDFUTILIZATION percent of the CPU or no TCB or stack is left
+int OS_CreateEdfThread(void(*task)(void *), void *arg, int32_t *stack, uint32_t stackBytes,
+                       uint32_t period, uint32_t deadline, uint32_t budget){
+  if((task == NULL) || (stackBytes < MINSTACKBYTES) || (budget == 0) ||
+     (budget > deadline) || (deadline > period)){
+    return 0;
+  }
+  // density budget/deadline, exact utilization when deadline == period
+  uint32_t density = (uint32_t)(((uint64_t)budget*1000000)/deadline);
+  long sr = OS_StartCritical();
+  if(EdfUtilization + density > EDFUTILIZATION*10000){
+    OS_EndCritical(sr);
+    return 0;                  // would not be schedulable
+  }
+  tcbType *thread = NewThread(task, arg, stack, stackBytes, 0);
+  if(thread == NULL){
+    OS_EndCritical(sr);
+    return 0;
+  }
+  EdfUtilization += density;
+  thread->edf = 1;
+  thread->period = period;
+  thread->relDeadline = deadline;
+  thread->budget = budget;
+  thread->used = 0;
+  thread->misses = 0;
+  thread->overruns = 0;
+  thread->release = TickCount;   // first job now
+  thread->deadline = TickCount + deadline;
+  ReadyInsert(thread);
+  if((RunPt != NULL) && (HighestReady() != RunPt)){
+    PendSwitch();
+  }
+  OS_EndCritical(sr);
+  return 1;
+}
+
+//******** OS_EdfWaitNext ***************
+// End the running EDF thread's job and sleep until its next release.
+// A job that ends after its deadline is counted as a miss
+// Inputs:  none
+// Outputs: none
+void OS_EdfWaitNext(void){
+  long sr = OS_StartCritical();
+  if(RunPt->edf){
+    if(TickCount > RunPt->deadline){
+      RunPt->misses++;
+    }
+    RunPt->release += RunPt->period;
+    if(RunPt->release > TickCount){
+      EdfSleepUntilRelease(RunPt);
+    } else{                      // already due, start the next job now
+      ReadyRemove(RunPt);
+      RunPt->deadline = RunPt->release + RunPt->relDeadline;
+      RunPt->used = 0;
+      ReadyInsert(RunPt);
+    }
+    PendSwitch();
+  }
+  OS_EndCritical(sr);
+}
+
+//******** OS_EdfStats ***************
+// Deadline record of an EDF thread
+// Inputs:  thread number, 0 for the first thread created
+//          where to put the number of missed deadlines
+//          where to put the number of budget overruns
+// Outputs: 1 if successful, 0 if it is not an EDF thread
+int OS_EdfStats(uint32_t thread, uint32_t *misses, uint32_t *overruns){
+  if((thread >= NumThreads) || !tcbs[thread].edf){
+    return 0;
+  }
+  long sr = OS_StartCritical();
+  *misses = tcbs[thread].misses;
+  *overruns = tcbs[thread].overruns;
+  OS_EndCritical(sr);
+  return 1;
+}
+#endif
+
 //******** OS_AddPeriodicEventThread ***************
 // Add one background periodic event thread
 // Typically this function receives the highest priority
 // Inputs: pointer to a void/void event thread function
-//         period given in units of OS_Launch (Lab 3 this will be msec)
+//         period in msec, real time whatever the time slice
 // Outputs: 1 if successful, 0 if this thread cannot be added
 // It is assumed that the event threads will run to completion and return
 // It is assumed the time to run these event threads is short compared to 1 msec
@@ -140,40 +623,210 @@ int OS_AddThreads(void(*thread0)(void),
 // These threads can call OS_Signal
 // In Lab 3 this will be called exactly twice
 int OS_AddPeriodicEventThread(void(*thread)(void), uint32_t period){
-// ****IMPLEMENT THIS****
-	static int index = 0;
-	if(index >= NUMPERIODIC) return 0;
-	Periodic[index].Task = thread; // Store the function pointer
-	Periodic[index].period = period; // Set the period
-	Periodic[index].counter = period; // Initialize the counter
-	index++;	
-  return 1; // Succesfully added
+  return OS_AddPeriodicEventUs(thread, period*1000);
+}
+
+//******** OS_AddPeriodicEventUs ***************
+// Add one background periodic event thread with a period in usec.
+// Releases are absolute, n periods after OS_Launch (or after this
+// call once launched), so a late run does not delay the next one.
+// An event runs at the first tick at or after its release
+// Inputs: pointer to a void/void event thread function
+//         period in usec, at most 53 seconds at 80 MHz
+// Outputs: 1 if successful, 0 if this thread cannot be added
+int OS_AddPeriodicEventUs(void(*thread)(void), uint32_t periodUs){
+  uint64_t period = (uint64_t)periodUs*CyclesPerUs;
+  if((thread == NULL) || (period == 0) || (period > 0xFFFFFFFF)){
+    return 0;
+  }
+  long sr = OS_StartCritical();
+  if(NumPeriodic >= NUMPERIODIC){
+    OS_EndCritical(sr);
+    return 0;
+  }
+  periodic_t *event = &Periodic[NumPeriodic];
+  event->Task = thread;
+  event->period = (uint32_t)period;
+  // before OS_Launch this is relative, OS_Launch adds the start time
+  event->release = (RunPt != NULL) ? CycleTime() + period : period;
+  event->stats.runs = 0;
+  event->stats.overruns = 0;
+  event->stats.missed = 0;
+  event->stats.minLate = 0xFFFFFFFF;
+  event->stats.maxLate = 0;
+  event->stats.maxExec = 0;
+  event->probe = NULL;
+  NumPeriodic++;
+  OS_EndCritical(sr);
+  return 1;
+}
+
+//******** OS_PeriodicStats ***************
+// Copy the timing record of a periodic event
+// Inputs: event number, 0 for the first one added
+//         where to put the record
+// Outputs: 1 if successful, 0 if there is no such event
+int OS_PeriodicStats(uint32_t event, OS_PeriodicStats_t *stats){
+  if(event >= NumPeriodic){
+    return 0;
+  }
+  long sr = OS_StartCritical();    // runPeriodicEvent writes it from SysTick
+  *stats = Periodic[event].stats;
+  OS_EndCritical(sr);
+  return 1;
+}
+
+// ******** OS_ProbeAttach ************
+// Let the kernel time a periodic event: release to start is its
+// lateness, start to end its run, so the event itself needs no calls
+// Inputs:  event number, 0 for the first one added
+//          probe from OS_ProbeInit, NULL to detach
+// Outputs: 1 if successful, 0 if there is no such event
+int OS_ProbeAttach(uint32_t event, OS_Probe_t *probe){
+  if(event >= NumPeriodic){
+    return 0;
+  }
+  long sr = OS_StartCritical();
+  Periodic[event].probe = probe;
+  OS_EndCritical(sr);
+  return 1;
+}
+
+// ******** CycleTime ************
+// Core cycles since OS_Init, 64 bits so it never wraps
+// Must run at least once per 2^32 cycles (53 s at 80 MHz),
+// SysTick_Handler and the bounded tickless sleep make sure of that
+static uint64_t CycleTime(void){
+  long sr = OS_StartCritical();
+  uint32_t now = DWT_CYCCNT;
+  if(now < CycleLast){
+    CycleHigh += 0x100000000ULL;  // CYCCNT wrapped
+  }
+  CycleLast = now;
+  uint64_t time = CycleHigh + now;
+  OS_EndCritical(sr);
+  return time;
+}
+
+// ******** OS_TimeUs ************
+// Microseconds since OS_Init, the time base of periodic events
+// Inputs:  none
+// Outputs: 64-bit time in usec, never wraps
+uint64_t OS_TimeUs(void){
+  return CycleTime()/CyclesPerUs;
+}
+
+// ******** runPeriodicEvent ************
+// Run one periodic event that is due and schedule its next release.
+// Lateness (release to start) measures jitter, a run that ends after
+// the next release is an overrun, and releases already in the past
+// when it ends are skipped and counted as missed
+// Called with interrupts disabled
+static void runPeriodicEvent(periodic_t *event, uint64_t now){
+  OS_PeriodicStats_t *stats = &event->stats;
+  uint64_t late = now - event->release;
+  if(late > 0xFFFFFFFF){
+    late = 0xFFFFFFFF;
+  }
+  if(late < stats->minLate) stats->minLate = (uint32_t)late;
+  if(late > stats->maxLate) stats->maxLate = (uint32_t)late;
+  OS_TRACE_POINT(OS_TRACE_EVENTRUN, event - Periodic, 0);
+  event->Task();
+  OS_TRACE_POINT(OS_TRACE_EVENTEND, event - Periodic, 0);
+  uint64_t end = CycleTime();
+  uint64_t exec = end - now;
+  if(exec > stats->maxExec){
+    stats->maxExec = (exec > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)exec;
+  }
+#if defined(OS_CPUSTATS) && !defined(OS_DEFEREVENTS)
+  EventCpu.total += exec;      // inside SysTick, keep it out of IsrCpu
+  EventCpu.window += (uint32_t)exec;
+  IsrStart += (uint32_t)exec;  // and out of the interrupted thread
+  CpuStamp += (uint32_t)exec;
+#endif
+  if(event->probe != NULL){
+    // the low 32 bits of the 64-bit time are CYCCNT
+    OS_ProbeSample(event->probe, (uint32_t)event->release, (uint32_t)now, (uint32_t)end);
+  }
+  stats->runs++;
+  event->release += event->period;   // absolute, does not drift
+  if(end >= event->release){
+    stats->overruns++;
+    while(end >= event->release){    // rare, only after a long stall
+      event->release += event->period;
+      stats->missed++;
+    }
+  }
 }
 
-void static runperiodicevents(void){
+// Inputs: number of ticks that have passed, more than 1 only after
+//         tickless idle, which never sleeps past the next deadline
+void static runperiodicevents(uint32_t ticks){
 // ****IMPLEMENT THIS****
 // **RUN PERIODIC THREADS, DECREMENT SLEEP COUNTERS
-  tcbType *temp = RunPt;           // Start from the current thread
-  for (int i = 0; i < NUMTHREADS; i++){
-    if (temp->sleep > 0){          // If the thread is sleeping...
-      temp->sleep--;               // ...decrement its sleep counter.
+  TickCount += ticks;
+  while((SleepList != NULL) && (SleepList->wakeTime <= TickCount)){
+    tcbType *thread = SleepList;   // head is due, wake it
+    SleepList = thread->sleepNext;
+    thread->sleep = 0;
+#ifdef OS_EDF
+    if(thread->edfWaiting){        // its next release, start a new job
+      thread->edfWaiting = 0;
+      thread->deadline = thread->release + thread->relDeadline;
+      thread->used = 0;
+    }
+#endif
+    if(thread->waitList != NULL){  // a timed wait ran out
+      WaitRemove(thread->waitList, thread);
+      thread->waitList = NULL;
+      thread->blocked = 0;
+      thread->timedOut = 1;
     }
-    temp = temp->next;             // Move to the next thread in the circular list.
+    ReadyInsert(thread);           // back in its ready list
   }
 
   // -------------------------------
   // 2. Process periodic event threads.
   // -------------------------------
-  for (int i = 0; i < NUMPERIODIC; i++){
-    if (Periodic[i].counter > 0){
-      Periodic[i].counter--;       // Decrement the periodic counter (assumed to be in ms).
-      if (Periodic[i].counter == 0){  // Time for this periodic event to run.
-        Periodic[i].Task();          // Call the periodic event function.
-        // Reset the counter back to its full period.
-        Periodic[i].counter = Periodic[i].period;
-      }
+  uint64_t now = CycleTime();   // every tick, keeps the 64-bit time current
+  for (uint32_t i = 0; i < NumPeriodic; i++){
+#ifdef OS_DEFEREVENTS
+    if ((now >= Periodic[i].release) && !(EventReleased&(1u<<i))){
+      EventReleased |= 1u<<i;     // only release it, OS_EventThread runs it
+      OS_TRACE_POINT(OS_TRACE_RELEASE, i, 0);
+    }
+#else
+    if (now >= Periodic[i].release){
+      OS_TRACE_POINT(OS_TRACE_RELEASE, i, 0);
+      runPeriodicEvent(&Periodic[i], now);
+      now = CycleTime();
+    }
+#endif
+  }
+}
+
+// ******** NextDeadline ************
+// Ticks until the next sleeper wakes or periodic event runs
+// Called with interrupts disabled, only from the idle thread
+// Outputs: 0xFFFFFFFF if nothing is pending
+static uint32_t NextDeadline(void){
+  uint32_t ticks = 0xFFFFFFFF;
+  if ((SleepList != NULL) && (SleepList->wakeTime - TickCount < ticks)){
+    ticks = (uint32_t)(SleepList->wakeTime - TickCount);
+  }
+  uint64_t now = CycleTime();
+  for (uint32_t i = 0; i < NumPeriodic; i++){
+    uint32_t due = 0;            // released already, run at the next tick
+    if (Periodic[i].release > now){
+      // the tick at or after the release, ticks start TimeSlice apart
+      uint64_t wait = (Periodic[i].release - now + TimeSlice - 1)/TimeSlice;
+      due = (wait < 0xFFFFFFFF) ? (uint32_t)wait : 0xFFFFFFFF;
+    }
+    if (due < ticks){
+      ticks = due;
     }
   }
+  return ticks;
 }
 
 //******** OS_Launch ***************
@@ -184,55 +837,736 @@ void static runperiodicevents(void){
 void OS_Launch(uint32_t theTimeSlice){
   STCTRL = 0;                  // disable SysTick during setup
   STCURRENT = 0;               // any write to current clears it
-  SYSPRI3 =(SYSPRI3&0x00FFFFFF)|0xE0000000; // priority 7
+  // SysTick priority 6 keeps time, PendSV priority 7 switches threads
+  // only after every other interrupt has finished
+  SYSPRI3 =(SYSPRI3&0x0000FFFF)|0xC0E00000;
   STRELOAD = theTimeSlice - 1; // reload value
+  TimeSlice = theTimeSlice;
+  RunPt = HighestReady();      // first thread to run
+  uint64_t start = CycleTime();
+  for(uint32_t i = 0; i < NumPeriodic; i++){
+    Periodic[i].release += start; // first release one period from now
+  }
+#ifdef OS_STACKGUARD
+  MPUNUMBER = 0;
+  MPUBASE = RunPt->guard;
+  MPUATTR = 0x10000009;        // XN, no access, 32 bytes (GUARDBYTES), enabled
+  MPUCTRL = 0x00000005;        // PRIVDEFENA, the default map everywhere else
+  SYSHNDCTRL |= 0x00010000;    // MEMFAULTENA, guard hits raise MemManage
+#endif
+  TickCount = 0;
+  TickStretch = 1;
+#ifdef OS_CPUSTATS
+  CpuLaunch = CycleTime();
+  CpuStamp = DWT_CYCCNT;
+  WindowStart = CpuStamp;
+  WindowCycles = 0;
+#endif
   STCTRL = 0x00000007;         // enable, core clock and interrupt arm
   StartOS();                   // start on the first task
 }
-// runs every ms
-void Scheduler(void){ // every time slice
-// ROUND ROBIN, skip blocked and sleeping threads
-  runperiodicevents();  // Process periodic events and decrement sleep counters
 
-  // Then pick the next thread that is not blocked and not sleeping
-  do {
-    RunPt = RunPt->next;
-  } while( (RunPt->blocked != 0) || (RunPt->sleep > 0) );
+// ******** PendSwitch ************
+// Request a context switch. PendSV runs as soon as no other
+// interrupt is active, so this is safe from threads and ISRs
+static void PendSwitch(void){
+#ifdef OS_BENCHMARK
+  SwitchStart = DWT_CYCCNT;
+#endif
+  INTCTRL = 0x10000000;        // PENDSVSET
+}
+
+// ******** RotateRunPt ************
+// Move the running thread behind the other ready threads of its priority
+// Called with interrupts disabled
+static void RotateRunPt(void){
+  if(RunPt != &IdleTcb){
+    uint32_t p = RunPt->priority;
+    if(RunPt == ReadyList[p]){
+      ReadyList[p] = RunPt->next;
+    }
+  }
+}
+
+// ******** HighestReady ************
+// Thread the scheduler would pick right now
+// Called with interrupts disabled
+static tcbType *HighestReady(void){
+#ifdef OS_DEFEREVENTS
+  if(EventReleased != 0){        // periodic events come first
+    return &EventTcb;
+  }
+#endif
+#ifdef OS_EDF
+  if(EdfList != NULL){           // earliest deadline first
+    return EdfList;
+  }
+#endif
+  if(ReadyBitmap == 0){          // everything blocked or sleeping
+    return &IdleTcb;
+  }
+  return ReadyList[OS_CLZ(ReadyBitmap)];
+}
+
+#ifdef OS_CPUSTATS
+// ******** CpuCharge ************
+// Charge the running thread for the cycles from CpuStamp to now
+// Called with interrupts disabled
+static void CpuCharge(cpu_t *cpu, uint32_t now){
+  uint32_t used = now - CpuStamp;
+  cpu->total += used;
+  cpu->window += used;
+  CpuStamp = now;
+}
+
+// ******** CpuRoll ************
+// End a window for one thread or bucket
+static void CpuRoll(cpu_t *cpu){
+  cpu->last = cpu->window;
+  cpu->window = 0;
+}
+
+// ******** CpuWindow ************
+// Close the utilization window once CPUWINDOW cycles have passed
+// Called with interrupts disabled, from SysTick_Handler
+static void CpuWindow(void){
+  uint32_t now = DWT_CYCCNT;
+  if(now - WindowStart < CPUWINDOW){
+    return;
+  }
+  CpuCharge(&RunPt->cpu, IsrStart);  // up to the start of this tick
+  for(uint32_t i = 0; i < NumThreads; i++){
+    CpuRoll(&tcbs[i].cpu);
+  }
+  CpuRoll(&IdleTcb.cpu);
+#ifdef OS_DEFEREVENTS
+  CpuRoll(&EventTcb.cpu);
+#else
+  CpuRoll(&EventCpu);
+#endif
+  CpuRoll(&IsrCpu);
+  WindowCycles = IsrStart - WindowStart;
+  WindowStart = IsrStart;
+}
+
+//******** OS_CpuIsrEnter ***************
+// Start charging an ISR's time to the ISR bucket instead of the
+// thread it interrupted. Nested ISRs count once, in the outermost
+// Inputs:  none
+// Outputs: none
+void OS_CpuIsrEnter(void){
+  long sr = OS_StartCritical();
+  if(IsrDepth == 0){
+    IsrStart = DWT_CYCCNT;
+  }
+  IsrDepth++;
+  OS_EndCritical(sr);
+}
+
+//******** OS_CpuIsrExit ***************
+// Stop charging the ISR bucket, last thing before the ISR returns
+// Inputs:  none
+// Outputs: none
+void OS_CpuIsrExit(void){
+  long sr = OS_StartCritical();
+  IsrDepth--;
+  if(IsrDepth == 0){
+    uint32_t used = DWT_CYCCNT - IsrStart;
+    IsrCpu.total += used;
+    IsrCpu.window += used;
+    CpuStamp += used;          // the interrupted thread is not charged
+  }
+  OS_EndCritical(sr);
+}
+
+//******** OS_CpuStats ***************
+// CPU time of a thread or bucket. ISRs that call OS_CpuIsrEnter and
+// OS_CpuIsrExit, and SysTick, are charged to OS_ISRS, not to the
+// thread they interrupt
+// Inputs: thread number, 0 for the first thread created,
+//         OS_IDLETHREAD for the kernel's idle thread,
+//         OS_EVENTTHREAD for the periodic events,
+//         or OS_ISRS for the ISRs
+//         where to put the statistics
+// Outputs: 1 if successful, 0 if there is no such thread
+int OS_CpuStats(uint32_t thread, OS_CpuStats_t *stats){
+  cpu_t *cpu;
+  if(thread == OS_IDLETHREAD){
+    cpu = &IdleTcb.cpu;
+  } else if(thread == OS_EVENTTHREAD){
+#ifdef OS_DEFEREVENTS
+    cpu = &EventTcb.cpu;
+#else
+    cpu = &EventCpu;
+#endif
+  } else if(thread == OS_ISRS){
+    cpu = &IsrCpu;
+  } else if(thread < NumThreads){
+    cpu = &tcbs[thread].cpu;
+  } else{
+    return 0;
+  }
+  long sr = OS_StartCritical();
+  uint64_t elapsed = CycleTime() - CpuLaunch;
+  stats->cycles = cpu->total;
+  stats->percent = elapsed ? (uint32_t)((cpu->total*10000)/elapsed) : 0;
+  stats->recent = WindowCycles ? (uint32_t)(((uint64_t)cpu->last*10000)/WindowCycles) : 0;
+  OS_EndCritical(sr);
+  return 1;
+}
+#endif
+
+#ifdef OS_EDF
+// ******** EdfSleepUntilRelease ************
+// Park an EDF thread in the sleep list until thread->release
+// Called with interrupts disabled, thread in EdfList
+static void EdfSleepUntilRelease(tcbType *thread){
+  ReadyRemove(thread);
+  thread->sleep = 1;
+  thread->edfWaiting = 1;
+  thread->wakeTime = thread->release;
+  SleepInsert(thread);
+}
+
+// ******** EdfCharge ************
+// Charge the running EDF thread for one tick. A job that uses up its
+// budget has missed: it is suspended until its next release and then
+// continues with a fresh budget, so it can never starve the others
+// Called with interrupts disabled, from SysTick_Handler
+static void EdfCharge(tcbType *thread){
+  thread->used++;
+  if((thread->used < thread->budget) || thread->blocked || thread->sleep){
+    return;
+  }
+  thread->overruns++;
+  thread->misses++;
+  do{
+    thread->release += thread->period;
+  } while(thread->release <= TickCount);
+  EdfSleepUntilRelease(thread);
+}
+#endif
+
+// ******** SysTick_Handler ************
+// Keeps time only: runs periodic events, wakes sleepers and ends the
+// time slice. The switch itself is left to PendSV in osasm.s
+void SysTick_Handler(void){
+  long sr = OS_StartCritical();    // periodic events run with the kernel masked
+  OS_TraceIsrEnter(15);
+  OS_CpuIsrEnter();
+  OS_BENCH_START();
+  uint32_t ticks = TickStretch;
+  SysTickInterrupts++;
+  if(STRELOAD != TimeSlice - 1){  // end of a stretched idle period
+    STRELOAD = TimeSlice - 1;
+    STCURRENT = 0;                // restart a full tick from here
+  }
+  TickStretch = 1;
+  runperiodicevents(ticks);  // Process periodic events and decrement sleep counters
+#ifdef OS_EDF
+  if(RunPt->edf){
+    EdfCharge(RunPt);
+  }
+#endif
+  RotateRunPt();        // time slice is over
+  if(HighestReady() != RunPt){
+    PendSwitch();
+  }
+#ifdef OS_CPUSTATS
+  CpuWindow();
+#endif
+  OS_BENCH_STOP(&SysTickBench);
+  OS_CpuIsrExit();
+  OS_TraceIsrExit(15);
+  OS_EndCritical(sr);
+}
+
+// ******** TicklessSleep ************
+// Stretch the SysTick period to reach the next deadline, sleep with WFI,
+// and account for the ticks that passed if another interrupt woke us early
+// Called with interrupts disabled, only from the idle thread
+static void TicklessSleep(void){
+  uint32_t ticks = NextDeadline();
+  uint32_t maxTicks = 0x00FFFFFF/TimeSlice;   // 24-bit SysTick counter
+  if(ticks > maxTicks){
+    ticks = maxTicks;
+  }
+  if((ticks <= 1) || (INTCTRL&0x04000000)){  // due now, or SysTick pending
+    OS_WaitForInterrupt();
+    return;
+  }
+  // SysTick stands still from here to the restart, so even interrupts
+  // above the kernel's ceiling wait those few instructions; their
+  // time would otherwise be lost to the tick
+  long pm = StartCritical();
+  STCTRL = 0x00000004;                        // stop, keep STCURRENT
+  if(INTCTRL&0x04000000){       // the tick ran out since the test above
+    STCTRL = 0x00000007;
+    EndCritical(pm);
+    return;                     // SysTick_Handler runs once the kernel unmasks
+  }
+  uint32_t remaining = STCURRENT;             // left in the current tick
+  if(remaining == 0){           // just written 0, STRELOAD loads next cycle
+    remaining = STRELOAD;
+  }
+  uint32_t reload = remaining + (ticks-1)*TimeSlice;
+  STRELOAD = reload;
+  STCURRENT = 0;                              // load the new period
+  STCTRL = 0x00000007;
+  EndCritical(pm);
+  TickStretch = ticks;
+
+  OS_WaitForInterrupt();                      // any interrupt wakes it
+
+  if(INTCTRL&0x04000000){
+    return;     // slept the whole period, SysTick_Handler credits the ticks
+  }
+  // woken early by another interrupt, count the whole ticks that passed
+  pm = StartCritical();
+  STCTRL = 0x00000004;
+  if(INTCTRL&0x04000000){       // period ran out while stopping SysTick
+    STRELOAD = TimeSlice - 1;
+    STCURRENT = 0;
+    STCTRL = 0x00000007;
+    EndCritical(pm);
+    return;
+  }
+  uint32_t elapsed = (TimeSlice-1-remaining) + (reload-STCURRENT);
+  uint32_t whole = elapsed/TimeSlice;
+  STRELOAD = TimeSlice - 1 - (elapsed%TimeSlice);  // rest of this tick
+  STCURRENT = 0;
+  STCTRL = 0x00000007;
+  EndCritical(pm);
+  TickStretch = 1;
+  if(whole > 0){
+    runperiodicevents(whole);   // no deadline falls inside, only counts down
+  }
+}
+
+// ******** OS_Idle ************
+// Kernel idle thread, runs only when every thread is blocked or sleeping.
+// Sleeps the CPU until the next deadline instead of taking every tick.
+static void OS_Idle(void){
+  while(1){
+    OS_StartCritical();
+    if(HighestReady() == &IdleTcb){  // still nothing to do
+      TicklessSleep();
+    }
+    if(HighestReady() != &IdleTcb){  // made ready while catching up
+      PendSwitch();
+    }
+    OS_EndCritical(0);          // the interrupt that woke us runs here
+  }
+}
+
+#ifdef OS_DEFEREVENTS
+// ******** OS_EventThread ************
+// Kernel thread that runs the periodic events SysTick released.
+// Events run with interrupts enabled, so the tick ISR stays short and
+// every interrupt can preempt them, while HighestReady keeps all
+// threads waiting until EventReleased is empty
+static void OS_EventThread(void){
+  while(1){
+    for(uint32_t i = 0; i < NumPeriodic; i++){
+      if(EventReleased&(1u<<i)){
+        // release is advanced before the bit clears, so SysTick
+        // never sees a half-updated release
+        runPeriodicEvent(&Periodic[i], CycleTime());
+        long sr = OS_StartCritical();
+        EventReleased &= ~(1u<<i);
+        OS_EndCritical(sr);
+      }
+    }
+    long sr = OS_StartCritical();
+    if(EventReleased == 0){
+      PendSwitch();              // caught up, let the threads run
+    }
+    OS_EndCritical(sr);
+  }
+}
+#endif
+
+#ifdef OS_TRACE
+// ******** TraceId ************
+// Thread id for trace records: the thread number, or
+// OS_TRACE_IDLE/OS_TRACE_EVENTS for the kernel's own threads
+static uint32_t TraceId(tcbType *thread){
+  if(thread == &IdleTcb){
+    return OS_TRACE_IDLE;
+  }
+#ifdef OS_DEFEREVENTS
+  if(thread == &EventTcb){
+    return OS_TRACE_EVENTS;
+  }
+#endif
+  return thread - tcbs;
+}
+
+// a semaphore's trace arg, its address in SRAM in words
+#define TRACESEMA(value) ((((uint32_t)(uintptr_t)(value))>>2)&0xFFFF)
+#endif
+
+// runs from PendSV_Handler with interrupts disabled
+void Scheduler(void){
+// PRIORITY, round robin among threads of the highest ready priority
+  OS_BENCH_START();
+#ifdef OS_CPUSTATS
+  CpuCharge(&RunPt->cpu, DWT_CYCCNT);
+#endif
+  RunPt = HighestReady();
+#ifdef OS_STACKGUARD
+  MPUBASE = RunPt->guard;      // move the guard under the new stack
+#endif
+  OS_TRACE_POINT(OS_TRACE_SWITCH, TraceId(RunPt), 0);
+  OS_BENCH_STOP(&SchedulerBench);
+}
+
+//******** OS_StackUsed ***************
+// Peak stack use of a thread, from the paint left at the bottom
+// of its stack. ISRs and periodic events run on whatever stack is
+// live, so their use counts against the thread they interrupted
+// Inputs: thread number, 0 for the first thread created,
+//         OS_IDLETHREAD for the kernel's idle thread,
+//         or OS_EVENTTHREAD for the periodic event thread
+// Outputs: most bytes ever used, 0 if there is no such thread
+uint32_t OS_StackUsed(uint32_t thread){
+  tcbType *t;
+  if(thread == OS_IDLETHREAD){
+    t = &IdleTcb;
+#ifdef OS_DEFEREVENTS
+  } else if(thread == OS_EVENTTHREAD){
+    t = &EventTcb;
+#endif
+  } else if(thread < NumThreads){
+    t = &tcbs[thread];
+  } else{
+    return 0;
+  }
+  uint32_t unused = 0;
+#ifdef OS_STACKGUARD
+  // the guard may be live over this stack, scan from the word above it
+  unused = ((t->guard & ~(uint32_t)(GUARDBYTES - 1)) + GUARDBYTES - (uint32_t)(uintptr_t)t->stackBase)/4;
+#endif
+  while((unused < t->stackWords) && (t->stackBase[unused] == (int32_t)STACKPAINT)){
+    unused++;
+  }
+  return (t->stackWords - unused)*4;
+}
+
+// ******** OS_StackFault ************
+// Called by HardFault_Handler and MemManage_Handler in osasm.s on a
+// stack of their own. Records which thread overflowed and stops
+// Inputs: stack pointer when the fault was taken
+// Outputs: none (does not return)
+void OS_StackFault(int32_t *sp){
+  FaultStatus = FAULTSTAT;
+  FaultAddress = MMADDR;
+  FaultSp = sp;
+  FaultThread = NULL;
+#ifdef OS_STACKGUARD
+  if(FaultStatus&0x000000FF){  // MemManage, the guard is the only region
+    FaultThread = RunPt;
+  }
+#endif
+  // without the guard an overflow shows as lost paint at the bottom
+  for(uint32_t i = 0; (FaultThread == NULL) && (i <= NumThreads); i++){
+    tcbType *t = (i < NumThreads) ? &tcbs[i] : &IdleTcb;
+    if((t->stackBase != NULL) && (t->stackBase[0] != (int32_t)STACKPAINT)){
+      FaultThread = t;
+    }
+  }
+#ifdef OS_DEFEREVENTS
+  if((FaultThread == NULL) && (EventStack[0] != (int32_t)STACKPAINT)){
+    FaultThread = &EventTcb;
+  }
+#endif
+  FaultOverflow = (FaultThread != NULL);
+  if(FaultThread == NULL){
+    FaultThread = RunPt;       // some other fault, blame the running thread
+  }
+  FaultTask = (FaultThread != NULL) ? FaultThread->task : NULL;
+  while(1){}                   // stop here, the debugger shows the Fault globals
+}
+
+#ifdef OS_BENCHMARK
+// called by PendSV_Handler just before returning to the new thread
+// Inputs: EXC_RETURN of the new thread, bit 4 clear if it uses the FPU
+void OS_BenchSwitch(uint32_t excReturn){
+  OS_Bench_t *b = (excReturn&0x10) ? &SwitchBench : &FpuSwitchBench;
+  uint32_t cycles = DWT_CYCCNT - SwitchStart;
+  b->last = cycles;
+  if(cycles < b->min) b->min = cycles;
+  if(cycles > b->max) b->max = cycles;
+  b->count++;
+  b->total += cycles;
 }
+#endif
 
 //******** OS_Suspend ***************
 // Called by main thread to cooperatively suspend operation
 // Inputs: none
 // Outputs: none
 // Will be run again depending on sleep/block status
+// Does not disturb SysTick, so the time base keeps running
 void OS_Suspend(void){
-  STCURRENT = 0;        // any write to current clears it
-  INTCTRL = 0x04000000; // trigger SysTick
-// next thread gets a full time slice
+  long sr = OS_StartCritical();
+  RotateRunPt();        // let equal-priority threads run first
+  PendSwitch();
+  OS_EndCritical(sr);      // PendSV runs here
 }
 
 // ******** OS_Sleep ************
 // place this thread into a dormant state
-// input:  number of msec to sleep
+// input:  number of ticks (OS_Launch time slices) to sleep
 // output: none
 // OS_Sleep(0) implements cooperative multitasking
 void OS_Sleep(uint32_t sleepTime){
 // set sleep parameter in TCB
-	DisableInterrupts();
-	RunPt->sleep = sleepTime;
-	EnableInterrupts();
+	long sr = OS_StartCritical();
+	if(sleepTime > 0){
+		RunPt->sleep = 1;
+		RunPt->wakeTime = TickCount + sleepTime;
+		ReadyRemove(RunPt);   // back in a ready list when wakeTime arrives
+		SleepInsert(RunPt);
+	}
+	OS_EndCritical(sr);
 // suspend, stops running
 	OS_Suspend();
 }
 
+// ******** OS_SleepUs ************
+// place this thread into a dormant state for at least a number of
+// microseconds, rounded up to whole ticks
+// input:  number of usec to sleep
+// output: none
+// Ticks have no length before OS_Launch, so until then it returns at once
+void OS_SleepUs(uint32_t us){
+	if(TimeSlice == 0){
+		return;              // not launched, nothing to sleep on
+	}
+	uint64_t cycles = (uint64_t)us*CyclesPerUs;
+	OS_Sleep((uint32_t)((cycles + TimeSlice - 1)/TimeSlice));
+}
+
+// ******** OS_TickCount ************
+// Number of ticks since OS_Launch, never wraps
+// Inputs:  none
+// Outputs: 64-bit tick count
+uint64_t OS_TickCount(void){
+	long sr = OS_StartCritical();    // two words, read them together
+	uint64_t now = TickCount;
+	OS_EndCritical(sr);
+	return now;
+}
+
+// ******** WaitInsert ************
+// Add a thread to a wait list, at the tail for FIFO order
+// or behind every waiter of equal or higher priority
+// Called with interrupts disabled, thread already out of its ready list
+static void WaitInsert(OS_WaitList_t *list, tcbType *thread){
+  tcbType *after = list->tail;
+  if(list->order == OS_ORDER_PRIORITY){
+    while((after != NULL) && (after->priority > thread->priority)){
+      after = after->prev;
+    }
+  }
+  thread->prev = after;
+  if(after == NULL){             // new head
+    thread->next = list->head;
+    list->head = thread;
+  } else{
+    thread->next = after->next;
+    after->next = thread;
+  }
+  if(thread->next == NULL){
+    list->tail = thread;
+  } else{
+    thread->next->prev = thread;
+  }
+  thread->onList = list;
+}
+
+// ******** WaitRemove ************
+// Unlink a thread from anywhere in a wait list
+// Called with interrupts disabled
+static void WaitRemove(OS_WaitList_t *list, tcbType *thread){
+  if(thread->prev == NULL){
+    list->head = thread->next;
+  } else{
+    thread->prev->next = thread->next;
+  }
+  if(thread->next == NULL){
+    list->tail = thread->prev;
+  } else{
+    thread->next->prev = thread->prev;
+  }
+  thread->onList = NULL;
+}
+
+// ******** SleepRemove ************
+// Take a thread out of the sleep list before its wake time,
+// when a timed wait is satisfied. Walks at most the sleepers
+// Called with interrupts disabled
+static void SleepRemove(tcbType *thread){
+  tcbType **pt = &SleepList;
+  while((*pt != NULL) && (*pt != thread)){
+    pt = &(*pt)->sleepNext;
+  }
+  if(*pt != NULL){
+    *pt = thread->sleepNext;
+  }
+  thread->sleep = 0;
+}
+
+// ******** WaitBlock ************
+// Block the running thread on a wait list, with a timeout
+// Called with interrupts disabled by a thread that had them enabled.
+// Interrupts are enabled while it is switched out and disabled
+// again when it returns
+// Inputs: wait list
+//         timeout in ticks, OS_WAITFOREVER for none, must not be 0
+// Outputs: 1 if woken by WaitWake, 0 if the timeout ran out
+static uint32_t WaitBlock(OS_WaitList_t *list, uint32_t timeout){
+  RunPt->blocked = (int32_t *)list;
+  RunPt->timedOut = 0;
+  ReadyRemove(RunPt);
+  WaitInsert(list, RunPt);
+  if(timeout != OS_WAITFOREVER){
+    RunPt->waitList = list;      // the tick takes it off the list on timeout
+    RunPt->sleep = 1;
+    RunPt->wakeTime = TickCount + timeout;
+    SleepInsert(RunPt);
+  }
+  PendSwitch();
+  OS_EndCritical(0);             // PendSV switches away here
+  OS_StartCritical();
+  return !RunPt->timedOut;
+}
+
+// ******** WaitWakeThread ************
+// Unblock one thread from anywhere in a wait list
+// Called with interrupts disabled
+static void WaitWakeThread(OS_WaitList_t *list, tcbType *thread){
+  WaitRemove(list, thread);
+  thread->blocked = 0;           //unblock the thread
+  if(thread->waitList != NULL){  // timed wait, cancel the timeout
+    SleepRemove(thread);
+    thread->waitList = NULL;
+  }
+  ReadyInsert(thread);
+  if(HighestReady() != RunPt){
+    PendSwitch();                // preempt as soon as interrupts are enabled
+  }
+}
+
+// ******** WaitWake ************
+// Unblock the thread at the head of a wait list
+// Called with interrupts disabled
+// Outputs: thread that was woken, NULL if nobody waits
+static tcbType *WaitWake(OS_WaitList_t *list){
+  tcbType *thread = list->head;
+  if(thread != NULL){
+    WaitWakeThread(list, thread);
+  }
+  return thread;
+}
+
+// ******** SemaWait / SemaSignal ************
+// Counting semaphore operations shared by Sema_t and the int32_t API
+static void SemaWait(int32_t *value, OS_WaitList_t *list){
+	long sr = OS_StartCritical();
+	OS_TRACE_POINT(OS_TRACE_WAIT, TraceId(RunPt), TRACESEMA(value));
+	(*value) = (*value) - 1;
+	if ((*value) < 0){
+		// Mark the current thread as blocked
+		RunPt->blocked = value;
+		ReadyRemove(RunPt);
+		WaitInsert(list, RunPt);
+		OS_EndCritical(sr);
+		OS_Suspend(); // yield control, runs again after a signal
+		return;
+	}
+	OS_EndCritical(sr);
+}
+
+static void SemaSignal(int32_t *value, OS_WaitList_t *list){
+	long sr = OS_StartCritical();
+	OS_BENCH_START();
+	OS_TRACE_POINT(OS_TRACE_SIGNAL, TraceId(RunPt), TRACESEMA(value));
+	(*value) = (*value) + 1;
+	if ((*value) <= 0){
+		WaitWake(list);  // head of the queue, no search
+	}
+	OS_BENCH_STOP(&SignalBench);
+	OS_EndCritical(sr);
+}
+
+// ******** OS_SemaInit ************
+// Initialize counting semaphore and its wait queue
+// Inputs:  pointer to a semaphore
+//          initial value of semaphore
+//          OS_ORDER_FIFO or OS_ORDER_PRIORITY wakeup order
+// Outputs: none
+void OS_SemaInit(Sema_t *sema, int32_t value, uint32_t order){
+  sema->value = value;
+  sema->waiters.head = NULL;
+  sema->waiters.tail = NULL;
+  sema->waiters.order = order;
+}
+
+// ******** OS_SemaWait ************
+// Decrement semaphore and block if less than zero
+// Inputs:  pointer to a semaphore
+// Outputs: none
+void OS_SemaWait(Sema_t *sema){
+  SemaWait(&sema->value, &sema->waiters);
+}
+
+// ******** OS_SemaSignal ************
+// Increment semaphore, wake the thread at the head of its queue
+// Runs in constant time, may be called from ISRs
+// Inputs:  pointer to a semaphore
+// Outputs: none
+void OS_SemaSignal(Sema_t *sema){
+  SemaSignal(&sema->value, &sema->waiters);
+}
+
+// ******** LegacyQueue ************
+// Wait queue lent to an int32_t semaphore, assigned on first use.
+// The search is bounded by NUMLEGACYSEMA, not by the thread count
+// Called with interrupts disabled
+// Outputs: NULL if all NUMLEGACYSEMA queues are taken
+static OS_WaitList_t *LegacyQueue(int32_t *semaPt){
+  legacysema_t *empty = NULL;
+  for(int i = 0; i < NUMLEGACYSEMA; i++){
+    if(LegacySema[i].semaPt == semaPt){
+      return &LegacySema[i].waiters;
+    }
+    if((empty == NULL) && (LegacySema[i].semaPt == NULL)){
+      empty = &LegacySema[i];
+    }
+  }
+  if(empty == NULL) return NULL;
+  empty->semaPt = semaPt;
+  empty->waiters.head = NULL;
+  empty->waiters.tail = NULL;
+  empty->waiters.order = OS_ORDER_FIFO;
+  return &empty->waiters;
+}
+
 // ******** OS_InitSemaphore ************
 // Initialize counting semaphore
+// Older API, each int32_t semaphore is given one of a small number of
+// FIFO wait queues inside the kernel, use Sema_t for new code
 // Inputs:  pointer to a semaphore
 //          initial value of semaphore
 // Outputs: none
 void OS_InitSemaphore(int32_t *semaPt, int32_t value){
 //***IMPLEMENT THIS***
+	long sr = OS_StartCritical();
 	*semaPt = value;
+	LegacyQueue(semaPt);   // claim its queue now, not in OS_Wait
+	OS_EndCritical(sr);
 }
 
 // ******** OS_Wait ************
@@ -241,18 +1575,24 @@ void OS_InitSemaphore(int32_t *semaPt, int32_t value){
 // Lab3 block if less than zero
 // Inputs:  pointer to a counting semaphore
 // Outputs: none
+// If every legacy queue is taken the caller spins with OS_Suspend
 void OS_Wait(int32_t *semaPt){
 //***IMPLEMENT THIS***
-	DisableInterrupts();
-	(*semaPt)=(*semaPt) - 1;
-	if ((*semaPt)<0){
-		// Mark the current thread as blocked
-		RunPt->blocked = semaPt;
-		EnableInterrupts();
-		OS_Sleep(0); // yield control (calls OS_Suspend internally)
+	long sr = OS_StartCritical();
+	OS_WaitList_t *list = LegacyQueue(semaPt);
+	OS_EndCritical(sr);
+	if(list != NULL){
+		SemaWait(semaPt, list);
+		return;
 	}
-	EnableInterrupts();
-	
+	sr = OS_StartCritical();    // out of queues, Lab2 style spinlock
+	while((*semaPt) <= 0){
+		OS_EndCritical(sr);
+		OS_Suspend();
+		sr = OS_StartCritical();
+	}
+	(*semaPt) = (*semaPt) - 1;
+	OS_EndCritical(sr);
 }
 
 // ******** OS_Signal ************
@@ -263,18 +1603,338 @@ void OS_Wait(int32_t *semaPt){
 // Outputs: none
 void OS_Signal(int32_t *semaPt){
 //***IMPLEMENT THIS***
-	DisableInterrupts();
-	(*semaPt) = (*semaPt) +1;
-	// Search for a thread blocked on this semaphore and unblock it
-	tcbType *temp = RunPt;
-	for (int i = 0; i < NUMTHREADS; i++){
-		if (temp->blocked == semaPt){
-			temp->blocked = 0; //unblock the thread
-			break; // if you expect only one thread to wait; otherwise, continue the search
-		}
-		temp = temp->next;
+	long sr = OS_StartCritical();
+	OS_WaitList_t *list = LegacyQueue(semaPt);
+	if(list != NULL){
+		SemaSignal(semaPt, list);
+	} else{
+		(*semaPt) = (*semaPt) + 1;  // spinning waiters will see it
 	}
-	EnableInterrupts();
+	OS_EndCritical(sr);
+}
+
+// ******** OS_QueueInit ************
+// Initialize an empty message queue over caller-supplied storage
+// Inputs:  pointer to the queue
+//          buffer of capacity*size bytes
+//          capacity, number of messages
+//          size, bytes per message
+// Outputs: 1 if successful, 0 if capacity or size is 0
+int OS_QueueInit(OS_Queue_t *queue, void *buffer, uint32_t capacity, uint32_t size){
+  if((capacity == 0) || (size == 0)){
+    return 0;
+  }
+  queue->buffer = (uint8_t *)buffer;
+  queue->size = size;
+  queue->capacity = capacity;
+  queue->count = 0;
+  queue->putI = 0;
+  queue->getI = 0;
+  queue->highWater = 0;
+  queue->drops = 0;
+  queue->senders.head = NULL;
+  queue->senders.tail = NULL;
+  queue->senders.order = OS_ORDER_PRIORITY;
+  queue->receivers.head = NULL;
+  queue->receivers.tail = NULL;
+  queue->receivers.order = OS_ORDER_PRIORITY;
+  return 1;
+}
+
+// ******** OS_QueueSend ************
+// Copy a message to the tail of a queue, blocking while it is full.
+// Any number of threads may send and receive
+// Inputs:  pointer to the queue
+//          message of the queue's size
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: 1 if sent, 0 if the queue stayed full (counted in drops)
+int OS_QueueSend(OS_Queue_t *queue, const void *msg, uint32_t timeout){
+  long sr = OS_StartCritical();
+  uint64_t deadline = TickCount + timeout;
+  while(queue->count == queue->capacity){
+    // woken senders recheck, another thread may have filled the slot
+    if((timeout == 0) ||
+       ((timeout != OS_WAITFOREVER) && (TickCount >= deadline)) ||
+       !WaitBlock(&queue->senders, (timeout == OS_WAITFOREVER) ?
+                  OS_WAITFOREVER : (uint32_t)(deadline - TickCount))){
+      queue->drops++;
+      OS_EndCritical(sr);
+      return 0;
+    }
+  }
+  memcpy(&queue->buffer[queue->putI*queue->size], msg, queue->size);
+  if(++queue->putI == queue->capacity){
+    queue->putI = 0;
+  }
+  queue->count++;
+  if(queue->count > queue->highWater){
+    queue->highWater = queue->count;
+  }
+  WaitWake(&queue->receivers);   // highest priority receiver, if any
+  OS_EndCritical(sr);
+  return 1;
+}
+
+// ******** OS_QueueSendISR ************
+// Send from an ISR or periodic event, never blocks
+// Inputs:  pointer to the queue
+//          message of the queue's size
+// Outputs: 1 if sent, 0 if the queue was full (counted in drops)
+int OS_QueueSendISR(OS_Queue_t *queue, const void *msg){
+  return OS_QueueSend(queue, msg, 0);
+}
+
+// ******** OS_QueueReceive ************
+// Copy the message at the head of a queue, blocking while it is empty
+// Inputs:  pointer to the queue
+//          room for a message of the queue's size
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: 1 if a message was received, 0 if the queue stayed empty
+int OS_QueueReceive(OS_Queue_t *queue, void *msg, uint32_t timeout){
+  long sr = OS_StartCritical();
+  uint64_t deadline = TickCount + timeout;
+  while(queue->count == 0){
+    if((timeout == 0) ||
+       ((timeout != OS_WAITFOREVER) && (TickCount >= deadline)) ||
+       !WaitBlock(&queue->receivers, (timeout == OS_WAITFOREVER) ?
+                  OS_WAITFOREVER : (uint32_t)(deadline - TickCount))){
+      OS_EndCritical(sr);
+      return 0;
+    }
+  }
+  memcpy(msg, &queue->buffer[queue->getI*queue->size], queue->size);
+  if(++queue->getI == queue->capacity){
+    queue->getI = 0;
+  }
+  queue->count--;
+  WaitWake(&queue->senders);     // highest priority sender, if any
+  OS_EndCritical(sr);
+  return 1;
+}
+
+// ******** SetPriority ************
+// Change the current priority of a thread, moving it to the ready
+// list of its new priority if it is ready, or to its new place in a
+// priority ordered wait list (mutex, semaphore, queue or flags)
+// Called with interrupts disabled
+static void SetPriority(tcbType *thread, uint32_t priority){
+  OS_WaitList_t *list = thread->onList;
+  if((thread->blocked == 0) && (thread->sleep == 0)){
+    ReadyRemove(thread);
+    thread->priority = priority;
+    ReadyInsert(thread);
+  } else if((list != NULL) && (list->order == OS_ORDER_PRIORITY)){
+    WaitRemove(list, thread);
+    thread->priority = priority;
+    WaitInsert(list, thread);
+  } else{
+    thread->priority = priority;
+  }
+}
+
+// ******** MutexBoost ************
+// Priority inheritance: raise the owner of a mutex to the priority of
+// a thread about to wait for it. SetPriority moves it up whatever
+// list it is in; if that is another mutex, raise that owner too
+// Called with interrupts disabled
+static void MutexBoost(OS_Mutex_t *mutex, uint32_t priority){
+  tcbType *owner = mutex->owner;
+  while((owner != NULL) && (priority < owner->priority)){
+    SetPriority(owner, priority);
+    mutex = owner->blockedMutex;
+    if(mutex == NULL){
+      break;
+    }
+    owner = mutex->owner;
+  }
+}
+
+// ******** MutexRestore ************
+// Drop a thread to the highest of its own priority and the priority
+// of every thread still waiting for a mutex it holds
+// Called with interrupts disabled
+static void MutexRestore(tcbType *thread){
+  uint32_t priority = thread->basePriority;
+  for(OS_Mutex_t *m = thread->held; m != NULL; m = m->nextHeld){
+    if((m->waiters.head != NULL) && (m->waiters.head->priority < priority)){
+      priority = m->waiters.head->priority;  // heads are the highest
+    }
+  }
+  if(priority != thread->priority){
+    SetPriority(thread, priority);
+  }
+}
+
+// ******** OS_MutexInit ************
+// Initialize an unlocked mutex
+// Inputs:  pointer to the mutex
+// Outputs: none
+void OS_MutexInit(OS_Mutex_t *mutex){
+  mutex->owner = NULL;
+  mutex->count = 0;
+  mutex->nextHeld = NULL;
+  mutex->waiters.head = NULL;
+  mutex->waiters.tail = NULL;
+  mutex->waiters.order = OS_ORDER_PRIORITY;
+}
+
+// ******** OS_MutexLock ************
+// Lock a mutex, blocking while another thread owns it. The owner
+// runs at the priority of its highest waiter until it unlocks, so a
+// waiter is blocked only for the owner's critical section.
+// The owner may lock again, each lock needs its own unlock
+// Threads only, never call from an ISR or periodic event
+// Inputs:  pointer to the mutex
+// Outputs: none
+void OS_MutexLock(OS_Mutex_t *mutex){
+  long sr = OS_StartCritical();
+  if(mutex->owner == NULL){
+    mutex->owner = RunPt;
+    mutex->count = 1;
+    mutex->nextHeld = RunPt->held;
+    RunPt->held = mutex;
+  } else if(mutex->owner == RunPt){
+    mutex->count++;              // recursive lock
+  } else{
+#ifdef OS_BENCHMARK
+    uint32_t start = DWT_CYCCNT;
+#endif
+    RunPt->blockedMutex = mutex;
+    MutexBoost(mutex, RunPt->priority);
+    WaitBlock(&mutex->waiters, OS_WAITFOREVER);
+    // OS_MutexUnlock made us the owner before waking us
+#ifdef OS_BENCHMARK
+    uint32_t cycles = DWT_CYCCNT - start;
+    MutexBench.last = cycles;
+    if(cycles < MutexBench.min) MutexBench.min = cycles;
+    if(cycles > MutexBench.max) MutexBench.max = cycles;
+    MutexBench.count++;
+    MutexBench.total += cycles;
+#endif
+  }
+  OS_EndCritical(sr);
+}
+
+// ******** OS_MutexUnlock ************
+// Undo one OS_MutexLock. The last unlock hands the mutex straight
+// to its highest priority waiter and drops any inherited priority
+// Inputs:  pointer to the mutex, owned by the calling thread
+// Outputs: none
+void OS_MutexUnlock(OS_Mutex_t *mutex){
+  long sr = OS_StartCritical();
+  if((mutex->owner != RunPt) || (--mutex->count > 0)){
+    OS_EndCritical(sr);             // not ours, or still locked recursively
+    return;
+  }
+  OS_Mutex_t **pt = &RunPt->held;
+  while(*pt != mutex){
+    pt = &(*pt)->nextHeld;
+  }
+  *pt = mutex->nextHeld;         // no longer held by us
+  MutexRestore(RunPt);           // before the wake compares priorities
+  tcbType *next = WaitWake(&mutex->waiters);
+  mutex->owner = next;
+  if(next != NULL){
+    next->blockedMutex = NULL;
+    mutex->count = 1;
+    mutex->nextHeld = next->held;
+    next->held = mutex;
+  }
+  if(HighestReady() != RunPt){
+    PendSwitch();                // dropped below another ready thread
+  }
+  OS_EndCritical(sr);
+}
+
+// ******** FlagsMatch ************
+// Flags of interest if they satisfy a wait, 0 if they do not
+static uint32_t FlagsMatch(uint32_t flags, uint32_t mask, uint32_t options){
+  uint32_t got = flags&mask;
+  if((options&OS_FLAGS_ALL) ? (got != mask) : (got == 0)){
+    return 0;
+  }
+  return got;
+}
+
+// ******** OS_FlagsInit ************
+// Initialize an event flag group
+// Inputs:  pointer to the group
+//          initial flags
+// Outputs: none
+void OS_FlagsInit(OS_Flags_t *group, uint32_t flags){
+  group->flags = flags;
+  group->waiters.head = NULL;
+  group->waiters.tail = NULL;
+  group->waiters.order = OS_ORDER_FIFO;
+}
+
+// ******** OS_FlagsSet ************
+// Set flags and wake every waiter they satisfy. Waiters that asked
+// for OS_FLAGS_CLEAR clear their flags once all have been checked,
+// so one set can satisfy several threads. Without waiters it is a
+// single OR, cheap enough for any ISR
+// Inputs:  pointer to the group
+//          flags to set
+// Outputs: none
+void OS_FlagsSet(OS_Flags_t *group, uint32_t flags){
+  long sr = OS_StartCritical();
+  group->flags |= flags;
+  uint32_t clear = 0;
+  tcbType *thread = group->waiters.head;
+  while(thread != NULL){
+    tcbType *next = thread->next;  // waking relinks thread
+    uint32_t got = FlagsMatch(group->flags, thread->flagsMask, thread->flagsOptions);
+    if(got != 0){
+      thread->flagsResult = got;
+      if(thread->flagsOptions&OS_FLAGS_CLEAR){
+        clear |= got;
+      }
+      WaitWakeThread(&group->waiters, thread);
+    }
+    thread = next;
+  }
+  group->flags &= ~clear;
+  OS_EndCritical(sr);
+}
+
+// ******** OS_FlagsClear ************
+// Clear flags without waking anyone
+// Inputs:  pointer to the group
+//          flags to clear
+// Outputs: flags before clearing
+uint32_t OS_FlagsClear(OS_Flags_t *group, uint32_t flags){
+  long sr = OS_StartCritical();
+  uint32_t old = group->flags;
+  group->flags = old&~flags;
+  OS_EndCritical(sr);
+  return old;
+}
+
+// ******** OS_FlagsWait ************
+// Wait until any (OS_FLAGS_ANY) or all (OS_FLAGS_ALL) of the flags
+// in mask are set. With OS_FLAGS_CLEAR the flags that satisfied the
+// wait are cleared on the way out. Threads only
+// Inputs:  pointer to the group
+//          mask, flags of interest, not 0
+//          options, OS_FLAGS_ANY or OS_FLAGS_ALL, plus OS_FLAGS_CLEAR
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: flags in mask that satisfied the wait, 0 on timeout
+uint32_t OS_FlagsWait(OS_Flags_t *group, uint32_t mask, uint32_t options, uint32_t timeout){
+  long sr = OS_StartCritical();
+  uint32_t got = FlagsMatch(group->flags, mask, options);
+  if(got != 0){
+    if(options&OS_FLAGS_CLEAR){
+      group->flags &= ~got;
+    }
+  } else if((mask != 0) && (timeout != 0)){
+    RunPt->flagsMask = mask;
+    RunPt->flagsOptions = options;
+    if(WaitBlock(&group->waiters, timeout)){
+      got = RunPt->flagsResult;  // OS_FlagsSet already cleared them
+    }
+  }
+  OS_EndCritical(sr);
+  return got;
 }
 
 #define FSIZE 10    // can be any size
@@ -295,7 +1955,7 @@ void OS_FIFO_Init(void){
 	GetI = 0;
 	CurrentSize = 0;
 	LostData = 0;
-	OS_InitSemaphore(&FifoSemaphore,0);
+	OS_SemaInit(&FifoSemaphore, 0, OS_ORDER_FIFO);
 	
 }
 
@@ -308,7 +1968,7 @@ void OS_FIFO_Init(void){
 int OS_FIFO_Put(uint32_t data){
 //***IMPLEMENT THIS***
 	int result;
-	DisableInterrupts(); // Start critical section
+	long sr = OS_StartCritical(); // Start critical section
 	if(CurrentSize == FSIZE){
 		LostData++;
 		result = -1; // FIFO is full
@@ -316,10 +1976,10 @@ int OS_FIFO_Put(uint32_t data){
 	Fifo[PutI] = data;
 	PutI = (PutI + 1) % FSIZE;
 	CurrentSize++;
-	OS_Signal(&FifoSemaphore); // signal that new data is availalble
+	OS_SemaSignal(&FifoSemaphore); // signal that new data is availalble
   result = 0;   // success
 	}
-	EnableInterrupts(); // end critical section
+	OS_EndCritical(sr); // end critical section
 	return result;
 
 }
@@ -332,13 +1992,13 @@ int OS_FIFO_Put(uint32_t data){
 // Outputs: data retrieved
 uint32_t OS_FIFO_Get(void){uint32_t data;
 //***IMPLEMENT THIS***
-	OS_Wait(&FifoSemaphore); //block if FIFO is empty
+	OS_SemaWait(&FifoSemaphore); //block if FIFO is empty
 	
-	DisableInterrupts(); // Start critical section
+	long sr = OS_StartCritical(); // Start critical section
 	data = Fifo[GetI];
 	GetI = (GetI + 1) % FSIZE;
 	CurrentSize--;
-	EnableInterrupts(); // end critical section
+	OS_EndCritical(sr); // end critical section
 
   return data;
 }
@@ -28,6 +28,103 @@
 #ifndef __OS_H
 #define __OS_H  1
 
+#include <stdint.h>
+
+// count leading zeros, a single instruction on the Cortex-M4,
+// undefined for 0
+#if defined(__CC_ARM)
+  #define OS_CLZ(x) __clz(x)
+#else
+  #define OS_CLZ(x) __builtin_clz(x)
+#endif
+
+struct tcb;   // thread control block, private to os.c
+
+// Threads blocked on a kernel object, linked through their TCBs
+// so waiting costs no extra memory. Woken from the head.
+typedef struct{
+  struct tcb *head;
+  struct tcb *tail;
+  uint32_t order;    // OS_ORDER_FIFO or OS_ORDER_PRIORITY
+} OS_WaitList_t;
+
+#define OS_ORDER_FIFO     0  // wake in the order threads started waiting
+#define OS_ORDER_PRIORITY 1  // wake the highest priority waiter first
+
+// Timing record of a periodic event, times in core cycles
+// (12.5 ns at 80 MHz), read with OS_PeriodicStats
+typedef struct{
+  uint32_t runs;     // times the event has run
+  uint32_t overruns; // runs that ended after the next release
+  uint32_t missed;   // releases skipped because a run ended after them
+  uint32_t minLate;  // least time from release to start
+  uint32_t maxLate;  // most time from release to start,
+                     // release jitter is maxLate - minLate
+  uint32_t maxExec;  // longest run
+} OS_PeriodicStats_t;
+
+// Counting semaphore that owns its wait queue
+typedef struct{
+  int32_t value;     // negative value is minus the number of waiters
+  OS_WaitList_t waiters;
+} Sema_t;
+
+#define OS_WAITFOREVER 0xFFFFFFFF  // timeout that never runs out
+
+// Mutex with priority inheritance, may be locked recursively
+typedef struct OS_Mutex{
+  struct tcb *owner;        // NULL when unlocked
+  uint32_t count;           // locks taken by the owner
+  struct OS_Mutex *nextHeld; // other mutexes held by the same owner
+  OS_WaitList_t waiters;    // highest priority first
+} OS_Mutex_t;
+
+// 32 event flags that threads can wait on, any or all of them
+typedef struct{
+  uint32_t flags;
+  OS_WaitList_t waiters;
+} OS_Flags_t;
+
+#define OS_FLAGS_ANY   0  // wake when any flag in the mask is set
+#define OS_FLAGS_ALL   1  // wake when every flag in the mask is set
+#define OS_FLAGS_CLEAR 2  // clear the flags that woke the waiter
+
+// Bounded message queue, any number of senders and receivers.
+// highWater and drops may be read at any time
+typedef struct{
+  uint8_t *buffer;   // capacity*size bytes, supplied by the caller
+  uint32_t size;     // bytes per message
+  uint32_t capacity; // most messages held
+  uint32_t count;    // messages held now
+  uint32_t putI;     // index of where to put next
+  uint32_t getI;     // index of where to get next
+  uint32_t highWater; // most messages ever held
+  uint32_t drops;    // sends that failed because the queue was full
+  OS_WaitList_t senders;   // blocked while full, highest priority first
+  OS_WaitList_t receivers; // blocked while empty, highest priority first
+} OS_Queue_t;
+
+// Kernel priority ceiling. With OS_BASEPRI, kernel critical sections
+// raise BASEPRI to this level instead of setting PRIMASK, so interrupts
+// at priorities 0 to OS_KERNELCEILING-1 are never held off by the
+// kernel. Those interrupts must not call any OS_ function. Every
+// interrupt that does must be at OS_KERNELCEILING or lower priority
+// (a number at least as large), as SysTick (6) and PendSV (7) are.
+// osasm.s keeps its own copy as KERNELBASEPRI
+#define OS_KERNELCEILING 2
+
+// ******** OS_StartCritical ************
+// Enter a kernel critical section: BASEPRI at the ceiling with
+// OS_BASEPRI, else PRIMASK like StartCritical. Sections nest
+// Inputs:  none
+// Outputs: previous mask, for OS_EndCritical
+long OS_StartCritical(void);
+
+// ******** OS_EndCritical ************
+// Leave a kernel critical section
+// Inputs:  mask from the matching OS_StartCritical
+// Outputs: none
+void OS_EndCritical(long sr);
 
 // ******** OS_Init ************
 // Initialize operating system, disable interrupts
@@ -37,23 +134,129 @@
 // Outputs: none
 void OS_Init(void);
 
+// Declare a thread stack of a given size in bytes, 8-byte aligned,
+// for OS_CreateThread when the caller owns the memory
+#define OS_STACK(name, bytes) int32_t name[(((bytes)+7)/8)*2] __attribute__((aligned(8)))
+
+//******** OS_CreateThread ***************
+// Add one main thread, before or after OS_Launch
+// Inputs: thread function, receives arg in R0
+//         arg passed to the thread
+//         stack buffer, or NULL to take stackBytes from the kernel's pool
+//         stackBytes, size of the stack (at least 256)
+//         priority, 0 is highest, 7 is lowest
+// Outputs: 1 if successful, 0 if this thread can not be added
+// Declare static stacks with OS_STACK so they are sized and aligned
+int OS_CreateThread(void(*task)(void *), void *arg,
+                    int32_t *stack, uint32_t stackBytes, uint32_t priority);
+
+#define OS_IDLETHREAD 0xFFFFFFFF  // OS_StackUsed of the kernel's idle thread
+#define OS_EVENTTHREAD 0xFFFFFFFE // and of the periodic event thread
+
+//******** OS_StackUsed ***************
+// Peak stack use of a thread, measured from the pattern painted
+// into its stack when it was created. ISRs and periodic events
+// count against the thread they interrupted. With OS_STACKGUARD the
+// bytes up to the top of the guard block are never counted, a thread
+// that reaches them takes MemManage instead
+// Inputs: thread number, 0 for the first thread created,
+//         OS_IDLETHREAD for the kernel's idle thread,
+//         or OS_EVENTTHREAD for the periodic event thread
+// Outputs: most bytes ever used, 0 if there is no such thread
+uint32_t OS_StackUsed(uint32_t thread);
+
+#define OS_ISRS 0xFFFFFFFD         // OS_CpuStats of the ISRs
+
+#ifdef OS_CPUSTATS
+typedef struct{
+  uint64_t cycles;     // core cycles used since OS_Launch
+  uint32_t percent;    // share of the CPU since OS_Launch, in 0.01%
+  uint32_t recent;     // share in the last one second window, in 0.01%
+} OS_CpuStats_t;
+
+//******** OS_CpuStats ***************
+// CPU time of a thread or bucket. ISRs that call OS_CpuIsrEnter and
+// OS_CpuIsrExit, and SysTick, are charged to OS_ISRS, not to the
+// thread they interrupt
+// Inputs: thread number, 0 for the first thread created,
+//         OS_IDLETHREAD for the kernel's idle thread,
+//         OS_EVENTTHREAD for the periodic events,
+//         or OS_ISRS for the ISRs
+//         where to put the statistics
+// Outputs: 1 if successful, 0 if there is no such thread
+int OS_CpuStats(uint32_t thread, OS_CpuStats_t *stats);
+
+//******** OS_CpuIsrEnter ***************
+// Start charging an ISR's time to the ISR bucket instead of the
+// thread it interrupted. Nested ISRs count once, in the outermost
+// Inputs:  none
+// Outputs: none
+void OS_CpuIsrEnter(void);
+
+//******** OS_CpuIsrExit ***************
+// Stop charging the ISR bucket, last thing before the ISR returns
+// Inputs:  none
+// Outputs: none
+void OS_CpuIsrExit(void);
+#else
+#define OS_CpuIsrEnter()
+#define OS_CpuIsrExit()
+#endif
+
 //******** OS_AddThreads ***************
-// Add six main threads to the scheduler
-// Inputs: function pointers to six void/void main threads
+// Add up to six main threads to the scheduler
+// Inputs: function pointers to six void/void main threads,
+//         NULL leaves the slot unused (the kernel has its own idle thread)
+//         priority of each thread, 0 is highest, 7 is lowest
+//         threads with equal priority share the CPU round robin
 // Outputs: 1 if successful, 0 if this thread can not be added
-// This function will only be called once, after OS_Init and before OS_Launch
-int OS_AddThreads(void(*thread0)(void),
-                  void(*thread1)(void),
-                  void(*thread2)(void),
-                  void(*thread3)(void),
-                  void(*thread4)(void),
-                  void(*thread5)(void));
+// Each thread gets a 400-byte stack from the kernel's pool
+// Call after OS_Init, OS_CreateThread adds any others
+int OS_AddThreads(void(*thread0)(void), uint32_t p0,
+                  void(*thread1)(void), uint32_t p1,
+                  void(*thread2)(void), uint32_t p2,
+                  void(*thread3)(void), uint32_t p3,
+                  void(*thread4)(void), uint32_t p4,
+                  void(*thread5)(void), uint32_t p5);
+
+#ifdef OS_EDF
+//******** OS_CreateEdfThread ***************
+// Add an earliest-deadline-first thread, before or after OS_Launch.
+// Each job is released every period ticks, must finish within
+// deadline ticks and may run for budget ticks. The thread calls
+// OS_EdfWaitNext at the end of each job. Ready EDF threads run
+// before every fixed-priority thread, the one due first first
+// Inputs: thread function, receives arg in R0
+//         arg passed to the thread
+//         stack buffer, or NULL to take stackBytes from the kernel's pool
+//         stackBytes, size of the stack (at least 256)
+//         period, deadline and budget in ticks, budget <= deadline <= period
+// Outputs: 1 if admitted, 0 if it would push the EDF threads past
+//          EDFUTILIZATION percent of the CPU or no TCB or stack is left
+int OS_CreateEdfThread(void(*task)(void *), void *arg, int32_t *stack, uint32_t stackBytes,
+                       uint32_t period, uint32_t deadline, uint32_t budget);
+
+//******** OS_EdfWaitNext ***************
+// End the running EDF thread's job and sleep until its next release.
+// A job that ends after its deadline is counted as a miss
+// Inputs:  none
+// Outputs: none
+void OS_EdfWaitNext(void);
+
+//******** OS_EdfStats ***************
+// Deadline record of an EDF thread
+// Inputs:  thread number, 0 for the first thread created
+//          where to put the number of missed deadlines
+//          where to put the number of budget overruns
+// Outputs: 1 if successful, 0 if it is not an EDF thread
+int OS_EdfStats(uint32_t thread, uint32_t *misses, uint32_t *overruns);
+#endif
 
 //******** OS_AddPeriodicEventThread ***************
 // Add one background periodic event thread
 // Typically this function receives the highest priority
 // Inputs: pointer to a void/void event thread function
-//         period given in units of OS_Launch (Lab 3 this will be msec)
+//         period in msec, real time whatever the time slice
 // Outputs: 1 if successful, 0 if this thread cannot be added
 // It is assumed that the event threads will run to completion and return
 // It is assumed the time to run these event threads is short compared to 1 msec
@@ -62,6 +265,23 @@ int OS_AddThreads(void(*thread0)(void),
 // In Lab 3 this will be called exactly twice
 int OS_AddPeriodicEventThread(void(*thread)(void), uint32_t period);
 
+//******** OS_AddPeriodicEventUs ***************
+// Add one background periodic event thread with a period in usec.
+// Releases are absolute, n periods after OS_Launch (or after this
+// call once launched), so a late run does not delay the next one.
+// An event runs at the first tick at or after its release
+// Inputs: pointer to a void/void event thread function
+//         period in usec, at most 53 seconds at 80 MHz
+// Outputs: 1 if successful, 0 if this thread cannot be added
+int OS_AddPeriodicEventUs(void(*thread)(void), uint32_t periodUs);
+
+//******** OS_PeriodicStats ***************
+// Copy the timing record of a periodic event
+// Inputs: event number, 0 for the first one added
+//         where to put the record
+// Outputs: 1 if successful, 0 if there is no such event
+int OS_PeriodicStats(uint32_t event, OS_PeriodicStats_t *stats);
+
 //******** OS_Launch ***************
 // Start the scheduler, enable interrupts
 // Inputs: number of clock cycles for each time slice
@@ -78,13 +298,56 @@ void OS_Suspend(void);
 
 // ******** OS_Sleep ************
 // place this thread into a dormant state
-// input:  number of msec to sleep
+// input:  number of ticks (OS_Launch time slices) to sleep
 // output: none
 // OS_Sleep(0) implements cooperative multitasking
 void OS_Sleep(uint32_t sleepTime);
 
+// ******** OS_SleepUs ************
+// place this thread into a dormant state for at least a number of
+// microseconds, rounded up to whole ticks
+// input:  number of usec to sleep
+// output: none
+// Ticks have no length before OS_Launch, so until then it returns at once
+void OS_SleepUs(uint32_t us);
+
+// ******** OS_TickCount ************
+// Number of ticks since OS_Launch, never wraps
+// Inputs:  none
+// Outputs: 64-bit tick count
+uint64_t OS_TickCount(void);
+
+// ******** OS_TimeUs ************
+// Microseconds since OS_Init, the time base of periodic events
+// Inputs:  none
+// Outputs: 64-bit time in usec, never wraps
+uint64_t OS_TimeUs(void);
+
+// ******** OS_SemaInit ************
+// Initialize counting semaphore and its wait queue
+// Inputs:  pointer to a semaphore
+//          initial value of semaphore
+//          OS_ORDER_FIFO or OS_ORDER_PRIORITY wakeup order
+// Outputs: none
+void OS_SemaInit(Sema_t *sema, int32_t value, uint32_t order);
+
+// ******** OS_SemaWait ************
+// Decrement semaphore and block if less than zero
+// Inputs:  pointer to a semaphore
+// Outputs: none
+void OS_SemaWait(Sema_t *sema);
+
+// ******** OS_SemaSignal ************
+// Increment semaphore, wake the thread at the head of its queue
+// Runs in constant time, may be called from ISRs
+// Inputs:  pointer to a semaphore
+// Outputs: none
+void OS_SemaSignal(Sema_t *sema);
+
 // ******** OS_InitSemaphore ************
 // Initialize counting semaphore
+// Older API, each int32_t semaphore is given one of a small number of
+// FIFO wait queues inside the kernel, use Sema_t for new code
 // Inputs:  pointer to a semaphore
 //          initial value of semaphore
 // Outputs: none
@@ -106,6 +369,97 @@ void OS_Wait(int32_t *semaPt);
 // Outputs: none
 void OS_Signal(int32_t *semaPt);
 
+// ******** OS_MutexInit ************
+// Initialize an unlocked mutex
+// Inputs:  pointer to the mutex
+// Outputs: none
+void OS_MutexInit(OS_Mutex_t *mutex);
+
+// ******** OS_MutexLock ************
+// Lock a mutex, blocking while another thread owns it. The owner
+// runs at the priority of its highest waiter until it unlocks, so a
+// waiter is blocked only for the owner's critical section.
+// The owner may lock again, each lock needs its own unlock
+// Threads only, never call from an ISR or periodic event
+// Inputs:  pointer to the mutex
+// Outputs: none
+void OS_MutexLock(OS_Mutex_t *mutex);
+
+// ******** OS_MutexUnlock ************
+// Undo one OS_MutexLock. The last unlock hands the mutex straight
+// to its highest priority waiter and drops any inherited priority
+// Inputs:  pointer to the mutex, owned by the calling thread
+// Outputs: none
+void OS_MutexUnlock(OS_Mutex_t *mutex);
+
+// ******** OS_FlagsInit ************
+// Initialize an event flag group
+// Inputs:  pointer to the group
+//          initial flags
+// Outputs: none
+void OS_FlagsInit(OS_Flags_t *group, uint32_t flags);
+
+// ******** OS_FlagsSet ************
+// Set flags and wake every waiter they satisfy. Waiters that asked
+// for OS_FLAGS_CLEAR clear their flags once all have been checked,
+// so one set can satisfy several threads. Without waiters it is a
+// single OR, cheap enough for any ISR
+// Inputs:  pointer to the group
+//          flags to set
+// Outputs: none
+void OS_FlagsSet(OS_Flags_t *group, uint32_t flags);
+
+// ******** OS_FlagsClear ************
+// Clear flags without waking anyone
+// Inputs:  pointer to the group
+//          flags to clear
+// Outputs: flags before clearing
+uint32_t OS_FlagsClear(OS_Flags_t *group, uint32_t flags);
+
+// ******** OS_FlagsWait ************
+// Wait until any (OS_FLAGS_ANY) or all (OS_FLAGS_ALL) of the flags
+// in mask are set. With OS_FLAGS_CLEAR the flags that satisfied the
+// wait are cleared on the way out. Threads only
+// Inputs:  pointer to the group
+//          mask, flags of interest, not 0
+//          options, OS_FLAGS_ANY or OS_FLAGS_ALL, plus OS_FLAGS_CLEAR
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: flags in mask that satisfied the wait, 0 on timeout
+uint32_t OS_FlagsWait(OS_Flags_t *group, uint32_t mask, uint32_t options, uint32_t timeout);
+
+// ******** OS_QueueInit ************
+// Initialize an empty message queue over caller-supplied storage
+// Inputs:  pointer to the queue
+//          buffer of capacity*size bytes
+//          capacity, number of messages
+//          size, bytes per message
+// Outputs: 1 if successful, 0 if capacity or size is 0
+int OS_QueueInit(OS_Queue_t *queue, void *buffer, uint32_t capacity, uint32_t size);
+
+// ******** OS_QueueSend ************
+// Copy a message to the tail of a queue, blocking while it is full.
+// Any number of threads may send and receive
+// Inputs:  pointer to the queue
+//          message of the queue's size
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: 1 if sent, 0 if the queue stayed full (counted in drops)
+int OS_QueueSend(OS_Queue_t *queue, const void *msg, uint32_t timeout);
+
+// ******** OS_QueueSendISR ************
+// Send from an ISR or periodic event, never blocks
+// Inputs:  pointer to the queue
+//          message of the queue's size
+// Outputs: 1 if sent, 0 if the queue was full (counted in drops)
+int OS_QueueSendISR(OS_Queue_t *queue, const void *msg);
+
+// ******** OS_QueueReceive ************
+// Copy the message at the head of a queue, blocking while it is empty
+// Inputs:  pointer to the queue
+//          room for a message of the queue's size
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: 1 if a message was received, 0 if the queue stayed empty
+int OS_QueueReceive(OS_Queue_t *queue, void *msg, uint32_t timeout);
+
 // ******** OS_FIFO_Init ************
 // Initialize FIFO. 
 // One event thread producer, one main thread consumer
@@ -13,25 +13,68 @@
 
         EXTERN  RunPt            ; currently running thread
         EXPORT  StartOS
-        EXPORT  SysTick_Handler
+        EXPORT  PendSV_Handler
+        EXPORT  HardFault_Handler
+        EXPORT  MemManage_Handler
+        EXPORT  OS_StartCritical
+        EXPORT  OS_EndCritical
+        EXPORT  OS_WaitForInterrupt
         IMPORT  Scheduler
+        IMPORT  OS_StackFault
+        IF :DEF:OS_BENCHMARK
+        IMPORT  OS_BenchSwitch
+        ENDIF
 
+; BASEPRI for OS_KERNELCEILING in os.h, priority in the top 3 bits
+; of the byte. Keep the two in step
+KERNELBASEPRI EQU 0x40
 
-SysTick_Handler               
+; SysTick_Handler (os.c) only keeps time. Threads, SysTick and
+; OS_Signal pend PendSV, which runs at the lowest priority
+; once every other ISR has returned, and switches threads here.
+; Bit 4 of EXC_RETURN is clear when the outgoing thread has an FPU
+; context. Only those threads save and restore S16-S31, and the
+; VPUSH is what triggers the lazy save of S0-S15 in the hardware
+; frame. EXC_RETURN is kept with R4-R11 so the restore knows which
+; kind of frame the incoming thread has.
+; With OS_BASEPRI only the kernel's interrupts are masked during the
+; switch. An interrupt above the ceiling may push its frame on either
+; thread's stack, as it could in the thread itself.
+PendSV_Handler
+    IF :DEF:OS_BASEPRI
+    MOV     R0, #KERNELBASEPRI ; R0 is in the hardware frame
+    MSR     BASEPRI, R0
+    ISB
+    ELSE
     CPSID   I                  
-    PUSH    {R4-R11}           
-    LDR     R0, =RunPt        
-    LDR     R1, [R0]           
+    ENDIF
+    TST     LR, #0x10          ; EXC_RETURN bit 4 clear, thread used the FPU
+    IT      EQ
+    VPUSHEQ {S16-S31}
+    PUSH    {R4-R11,LR}        
+    LDR     R4, =RunPt         ; R4 is saved, survives the call
+    LDR     R1, [R4]           
     STR     SP, [R1]          
-    PUSH    {R0,LR}            
+    SUB     SP, SP, #4         ; 8-byte align for C, SP is reloaded below
     BL      Scheduler         
-    POP     {R0,LR}            
-    LDR     R0, =RunPt           
-    ;STR     R1, [R0]  Old Bennett
-	LDR     R1, [R0]
+    LDR     R1, [R4]           ; R1 = new TCB pointer (updated by Scheduler)
     LDR     SP, [R1]           
-    POP     {R4-R11}           
+    POP     {R4-R11,LR}        
+    TST     LR, #0x10
+    IT      EQ
+    VPOPEQ  {S16-S31}
+    IF :DEF:OS_BENCHMARK
+    PUSH    {R0,LR}
+    MOV     R0, LR             ; EXC_RETURN, integer or FPU switch
+    BL      OS_BenchSwitch
+    POP     {R0,LR}
+    ENDIF
+    IF :DEF:OS_BASEPRI
+    MOV     R0, #0             ; the incoming thread was switched out
+    MSR     BASEPRI, R0        ; with nothing masked, as it resumes
+    ELSE
     CPSIE   I                  
+    ENDIF
     BX      LR                 
 
 StartOS
@@ -39,6 +82,7 @@ StartOS
     LDR     R1, [R0]         
     LDR     SP, [R1]          
     POP     {R4-R11}          
+    ADD     SP,SP,#4           ; skip EXC_RETURN, first thread has no FPU state
     POP     {R0-R3}          
     POP     {R12}
     ADD     SP,SP,#4           
@@ -47,5 +91,66 @@ StartOS
     CPSIE   I                  ; Enable interrupts at processor level
     BX      LR                 ; start first thread
 
+; Kernel critical sections, see os.h. With OS_BASEPRI they mask
+; SysTick, PendSV and every interrupt that may call the kernel, and
+; leave the ones above the ceiling running. BASEPRI_MAX only ever
+; raises the mask, so a nested section leaves it where it is.
+; Without OS_BASEPRI they are StartCritical and EndCritical.
+OS_StartCritical
+    IF :DEF:OS_BASEPRI
+    MRS     R0, BASEPRI        ; previous mask, 0 if none
+    MOV     R1, #KERNELBASEPRI
+    MSR     BASEPRI_MAX, R1
+    ISB
+    ELSE
+    MRS     R0, PRIMASK
+    CPSID   I
+    ENDIF
+    BX      LR
+
+OS_EndCritical
+    IF :DEF:OS_BASEPRI
+    MSR     BASEPRI, R0
+    ELSE
+    MSR     PRIMASK, R0
+    ENDIF
+    BX      LR
+
+; Idle sleep, called in a kernel critical section and returns in one.
+; WFI wakes for interrupts PRIMASK masks but not for ones BASEPRI
+; masks, so with OS_BASEPRI the mask is traded for the I bit while
+; asleep. Interrupts above the ceiling run as soon as it wakes; the
+; kernel's wait for OS_EndCritical as they do without OS_BASEPRI.
+OS_WaitForInterrupt
+    IF :DEF:OS_BASEPRI
+    MRS     R0, BASEPRI
+    CPSID   I
+    MOV     R1, #0
+    MSR     BASEPRI, R1
+    WFI
+    MSR     BASEPRI, R0
+    CPSIE   I
+    ELSE
+    WFI
+    ENDIF
+    BX      LR
+
+; Threads, ISRs and periodic events all run on MSP, so after an
+; overflow SP points at or below the bottom of the running thread's
+; stack. Move to a stack of our own before calling C to report it.
+HardFault_Handler
+MemManage_Handler
+    CPSID   I
+    MOV     R0, SP             ; SP when the fault was taken
+    LDR     R1, =FaultStackTop
+    MOV     SP, R1
+    B       OS_StackFault      ; does not return
+
     ALIGN
+
+        AREA    |.bss|, NOINIT, READWRITE, ALIGN=3
+FaultStack
+        SPACE   256
+FaultStackTop
+
     END
@@ -0,0 +1,64 @@
+// osbench.h
+// Runs on TM4C123
+// Cycle-count instrumentation for the RTOS kernel, built on the
+// DWT cycle counter (CYCCNT runs at the core clock, 12.5 ns at 80 MHz).
+// Everything in this file compiles to nothing unless OS_BENCHMARK is
+// defined (Options for Target->C/C++->Define, and Asm->Define for the
+// hooks in osasm.s), so release builds pay no cost. Results are read
+// with the debugger's watch window.
+
+#ifndef __OSBENCH_H
+#define __OSBENCH_H  1
+
+#include <stdint.h>
+
+typedef struct{
+  uint32_t last;     // cycles measured by the most recent sample
+  uint32_t min;      // fewest cycles seen
+  uint32_t max;      // most cycles seen
+  uint32_t count;    // number of samples
+  uint32_t total;    // sum of all samples, mean = total/count
+} OS_Bench_t;
+
+#ifdef OS_BENCHMARK
+
+// ******** OS_BenchInit ************
+// Enable the trace unit and start the DWT cycle counter
+// Inputs:  none
+// Outputs: none
+#define OS_BenchInit() do{ \
+  DEMCR |= 0x01000000;        /* TRCENA, powers the DWT */ \
+  DWT_CYCCNT = 0;             \
+  DWT_CTRL |= 0x00000001;     /* CYCCNTENA */ \
+}while(0)
+
+// ******** OS_BenchReset ************
+// Clear a statistic so the next sample sets min and max
+#define OS_BenchReset(b) do{ \
+  (b)->last = 0; (b)->min = 0xFFFFFFFF; (b)->max = 0; \
+  (b)->count = 0; (b)->total = 0; \
+}while(0)
+
+// OS_BENCH_START/OS_BENCH_STOP bracket the code being measured
+// and must appear in the same block
+#define OS_BENCH_START() uint32_t osBenchStart_ = DWT_CYCCNT
+
+#define OS_BENCH_STOP(b) do{ \
+  uint32_t osBenchCycles_ = DWT_CYCCNT - osBenchStart_; \
+  (b)->last = osBenchCycles_; \
+  if(osBenchCycles_ < (b)->min) (b)->min = osBenchCycles_; \
+  if(osBenchCycles_ > (b)->max) (b)->max = osBenchCycles_; \
+  (b)->count++; \
+  (b)->total += osBenchCycles_; \
+}while(0)
+
+#else
+
+#define OS_BenchInit()
+#define OS_BenchReset(b)
+#define OS_BENCH_START()
+#define OS_BENCH_STOP(b)
+
+#endif
+
+#endif
@@ -0,0 +1,132 @@
+// oslatency.c
+// Runs on TM4C123
+// Interrupt latency probe on TIMER2A, 32-bit periodic at the bus
+// clock, which is the core clock. The counter reloads at the timeout
+// and keeps counting down, so the ISR's first read of TAV says how
+// many cycles have passed since: reload minus TAV. TAILD makes each
+// new reload take effect at the next timeout, so the TAILR the ISR
+// reads is the one it is counting from. Correct up to one period late.
+// The ISR makes no kernel calls and takes no locks, it is the only
+// writer and OS_LatencyStats retries if it was interrupted, so at
+// priority 0 the probe itself never masks anything.
+
+#include <stdint.h>
+#include "os.h"
+#include "oslatency.h"
+#include "CortexM.h"
+#include "BSP.h"
+#include "tm4c123gh6pm.h"
+
+static uint32_t Base;          // shortest reload, cycles
+static uint32_t Spread;        // jitter mask, a power of two minus 1
+static uint32_t Seed;          // pseudo-random jitter
+static volatile uint32_t Sequence;  // odd while the ISR updates
+static volatile uint32_t Count, Min, Max;
+static volatile uint64_t Sum;
+static volatile uint32_t Hist[OS_LATENCYBINS];
+
+// ******** nextReload ************
+// Period minus one for TAILR, Base plus up to Spread cycles
+static uint32_t nextReload(void){
+  Seed = Seed*1664525 + 1013904223;   // LCG, the top bits are the good ones
+  return Base + ((Seed>>16)&Spread);
+}
+
+// ******** OS_LatencyStart ************
+// Clear the statistics and start sampling. The period varies by up
+// to 1/8 so samples fall at every phase of SysTick and the threads
+// Inputs:  priority of TIMER2A, 0 is highest, 7 is lowest;
+//          below OS_KERNELCEILING the ISR never calls the kernel anyway
+//          periodUs, average time between samples, 10 to 1000000
+// Outputs: 1 if successful, 0 if an input is out of range
+int OS_LatencyStart(uint32_t priority, uint32_t periodUs){
+  long sr;
+  if((priority > 7) || (periodUs < 10) || (periodUs > 1000000)){
+    return 0;
+  }
+  uint32_t period = periodUs*(BSP_Clock_GetFreq()/1000000);
+  Spread = 1;
+  while(Spread <= period/16){
+    Spread = Spread<<1;              // period/16 < Spread <= period/8
+  }
+  Spread = Spread - 1;
+  Base = period - Spread/2 - 1;
+  Seed = period;
+  sr = StartCritical();
+  Count = 0;
+  Min = 0xFFFFFFFF;
+  Max = 0;
+  Sum = 0;
+  for(int i = 0; i < OS_LATENCYBINS; i++){
+    Hist[i] = 0;
+  }
+  SYSCTL_RCGCTIMER_R |= 0x04;        // activate TIMER2
+  while((SYSCTL_PRTIMER_R&0x04) == 0){};
+  TIMER2_CTL_R &= ~TIMER_CTL_TAEN;   // disable TIMER2A during setup
+  TIMER2_CFG_R = TIMER_CFG_32_BIT_TIMER;
+  TIMER2_TAMR_R = TIMER_TAMR_TAMR_PERIOD;  // down count, TAILR loads now
+  TIMER2_TAILR_R = nextReload();
+  TIMER2_TAMR_R = TIMER_TAMR_TAMR_PERIOD|TIMER_TAMR_TAILD;  // from now at timeouts
+  TIMER2_TAPR_R = 0;                 // bus clock resolution
+  TIMER2_ICR_R = TIMER_ICR_TATOCINT; // clear TIMER2A timeout flag
+  TIMER2_IMR_R |= TIMER_IMR_TATOIM;  // arm timeout interrupt
+//Bits 31:29 Interrupt [4n+3]        n=5 => (4n+3)=23
+  NVIC_PRI5_R = (NVIC_PRI5_R&0x1FFFFFFF)|(priority<<29);
+  NVIC_EN0_R = 1<<23;                // enable IRQ 23 in NVIC
+  TIMER2_CTL_R |= TIMER_CTL_TAEN;
+  TIMER2_TAILR_R = nextReload();     // the first timeout reloads with it
+  EndCritical(sr);
+  return 1;
+}
+
+// ******** OS_LatencyStop ************
+// Stop sampling, the statistics stay readable
+// Inputs:  none
+// Outputs: none
+void OS_LatencyStop(void){
+  TIMER2_CTL_R &= ~TIMER_CTL_TAEN;
+  TIMER2_IMR_R &= ~TIMER_IMR_TATOIM; // disarm timeout interrupt
+  NVIC_DIS0_R = 1<<23;               // disable IRQ 23 in NVIC
+  TIMER2_ICR_R = TIMER_ICR_TATOCINT;
+}
+
+void TIMER2A_Handler(void){
+  uint32_t now = TIMER2_TAV_R;       // first, everything after is not latency
+  TIMER2_ICR_R = TIMER_ICR_TATOCINT; // acknowledge TIMER2A timeout
+  uint32_t latency = TIMER2_TAILR_R - now;  // what this timeout reloaded with
+  TIMER2_TAILR_R = nextReload();     // and what the next one will
+  uint32_t bin = (latency == 0) ? 0 : 31 - OS_CLZ(latency);
+  if(bin >= OS_LATENCYBINS){
+    bin = OS_LATENCYBINS - 1;
+  }
+  Sequence++;
+  Hist[bin]++;
+  Count++;
+  Sum += latency;
+  if(latency < Min) Min = latency;
+  if(latency > Max) Max = latency;
+  Sequence++;
+}
+
+// ******** OS_LatencyStats ************
+// Snapshot the statistics while sampling goes on
+// Inputs:  where to put them
+// Outputs: none
+void OS_LatencyStats(OS_LatencyStats_t *stats){
+  uint32_t before;
+  uint64_t sum;
+  do{                                // again if TIMER2A_Handler ran meanwhile
+    before = Sequence;
+    stats->count = Count;
+    stats->min = Min;
+    stats->max = Max;
+    sum = Sum;
+    for(int i = 0; i < OS_LATENCYBINS; i++){
+      stats->hist[i] = Hist[i];
+    }
+  }while((before&1) || (Sequence != before));
+  stats->mean = (stats->count == 0) ? 0 : (uint32_t)(sum/stats->count);
+  if(stats->count == 0){
+    stats->min = 0;
+  }
+}
@@ -0,0 +1,50 @@
+// oslatency.h
+// Runs on TM4C123
+// Interrupt latency probe: TIMER2A times out at a jittered period
+// and its ISR reads how many cycles ago that was. Run it at priority 0
+// to see what an interrupt above OS_KERNELCEILING waits for, 0 extra
+// cycles with OS_BASEPRI, or at the ceiling or below to see the
+// kernel's own critical sections. Uses TIMER2A and its vector.
+
+#ifndef __OSLATENCY_H
+#define __OSLATENCY_H  1
+
+#include <stdint.h>
+
+// bin 0 counts latencies under 2 cycles, bin k counts 2^k to
+// 2^(k+1)-1 cycles, the last bin everything from 2^(OS_LATENCYBINS-1) up
+#define OS_LATENCYBINS 16
+
+// Timeout to the ISR's first read of the timer, in core cycles.
+// The smallest possible is the exception entry plus that read, about
+// 15 cycles; anything above the minimum was spent waiting
+typedef struct{
+  uint32_t count;                 // samples
+  uint32_t min;                   // fewest cycles seen
+  uint32_t max;                   // most cycles seen
+  uint32_t mean;                  // cycles
+  uint32_t hist[OS_LATENCYBINS];  // samples per log2 range of cycles
+} OS_LatencyStats_t;
+
+// ******** OS_LatencyStart ************
+// Clear the statistics and start sampling. The period varies by up
+// to 1/8 so samples fall at every phase of SysTick and the threads
+// Inputs:  priority of TIMER2A, 0 is highest, 7 is lowest;
+//          below OS_KERNELCEILING the ISR never calls the kernel anyway
+//          periodUs, average time between samples, 10 to 1000000
+// Outputs: 1 if successful, 0 if an input is out of range
+int OS_LatencyStart(uint32_t priority, uint32_t periodUs);
+
+// ******** OS_LatencyStop ************
+// Stop sampling, the statistics stay readable
+// Inputs:  none
+// Outputs: none
+void OS_LatencyStop(void);
+
+// ******** OS_LatencyStats ************
+// Snapshot the statistics while sampling goes on
+// Inputs:  where to put them
+// Outputs: none
+void OS_LatencyStats(OS_LatencyStats_t *stats);
+
+#endif
@@ -0,0 +1,257 @@
+// ospool.c
+// Runs on TM4C123
+// Fixed-block memory pools and mailbox for zero-copy messages.
+// Alloc and free pop and push the head of a free list inside a
+// short critical section, so both are constant time and ISR-safe.
+// The same critical section flips the block's bit in the allocation
+// bitmap and updates the statistics.
+// The mailbox is an OS_Queue_t whose messages are block pointers.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "os.h"
+#include "ospool.h"
+#include "CortexM.h"
+#include "BSP.h"
+
+static OS_Pool_t *PoolList;      // every pool, newest first
+
+// ******** OS_PoolInit ************
+// Carve memory into blocks, link them all into the free list, clear
+// the statistics and add the pool to the list read by OS_PoolNext.
+// Every block must be free when a pool is initialized again
+// Inputs:  pointer to the pool
+//          word-aligned memory from OS_POOL_MEMORY: blocks*blockSize
+//          bytes followed by one bit per block, in whole words
+//          blockSize, bytes per block, rounded up to a multiple of 4
+//          blocks, number of blocks
+// Outputs: 1 if successful, 0 if blockSize or blocks is 0
+int OS_PoolInit(OS_Pool_t *pool, void *memory, uint32_t blockSize, uint32_t blocks){
+  if((blockSize == 0) || (blocks == 0)){
+    return 0;
+  }
+  blockSize = (blockSize + 3) & ~3;   // every block holds an aligned link
+  uint8_t *block = (uint8_t *)memory;
+  for(uint32_t i = 0; i < blocks - 1; i++){
+    *(void **)block = block + blockSize;
+    block += blockSize;
+  }
+  *(void **)block = NULL;             // last block ends the list
+  uint32_t *allocated = (uint32_t *)(block + blockSize);
+  for(uint32_t i = 0; i < (blocks + 31)/32; i++){
+    allocated[i] = 0;                 // every block free
+  }
+  long sr = OS_StartCritical();
+  pool->free = memory;
+  pool->start = (uint8_t *)memory;
+  pool->end = (uint8_t *)memory + blockSize*blocks;
+  pool->allocated = allocated;
+  pool->blockSize = blockSize;
+  pool->blocks = blocks;
+  pool->used = 0;
+  pool->peak = 0;
+  pool->allocs = 0;
+  pool->fails = 0;
+  pool->badFrees = 0;
+  OS_Pool_t *listed = PoolList;
+  while((listed != NULL) && (listed != pool)){
+    listed = listed->next;
+  }
+  if(listed == NULL){                 // not already on the list
+    pool->next = PoolList;
+    PoolList = pool;
+  }
+  OS_EndCritical(sr);
+  return 1;
+}
+
+// ******** OS_PoolAlloc ************
+// Take a block from the pool in constant time, callable from ISRs
+// Inputs:  pointer to the pool
+// Outputs: pointer to the block, NULL if none is free
+void *OS_PoolAlloc(OS_Pool_t *pool){
+  long sr = OS_StartCritical();
+  void *block = pool->free;
+  if(block != NULL){
+    uint32_t i = (uint32_t)((uint8_t *)block - pool->start)/pool->blockSize;
+    pool->free = *(void **)block;
+    pool->allocated[i/32] |= 1u<<(i%32);
+    pool->used++;
+    pool->allocs++;
+    if(pool->used > pool->peak){
+      pool->peak = pool->used;
+    }
+  } else{
+    pool->fails++;
+  }
+  OS_EndCritical(sr);
+  return block;
+}
+
+// ******** OS_PoolFree ************
+// Return a block to the pool in constant time, callable from ISRs.
+// A pointer that is not the start of one of the pool's blocks, or a
+// block that is not allocated (freed twice), is counted in badFrees
+// and ignored, so it can not corrupt the free list
+// Inputs:  pointer to the pool
+//          block from OS_PoolAlloc on the same pool, NULL is ignored
+// Outputs: none
+void OS_PoolFree(OS_Pool_t *pool, void *block){
+  if(block == NULL){
+    return;
+  }
+  uint8_t *b = (uint8_t *)block;
+  uint32_t offset = (uint32_t)(b - pool->start);
+  uint32_t i = offset/pool->blockSize;
+  uint32_t bit = 1u<<(i%32);
+  long sr = OS_StartCritical();
+  if((b < pool->start) || (b >= pool->end) || (offset != i*pool->blockSize) ||
+     ((pool->allocated[i/32]&bit) == 0)){
+    pool->badFrees++;               // not one of our blocks, or already free
+  } else{
+    pool->allocated[i/32] &= ~bit;
+    *(void **)block = pool->free;
+    pool->free = block;
+    pool->used--;
+  }
+  OS_EndCritical(sr);
+}
+
+// ******** OS_PoolStats ************
+// Copy a consistent snapshot of a pool's use
+// Inputs:  pointer to the pool
+//          where to put the statistics
+// Outputs: none
+void OS_PoolStats(OS_Pool_t *pool, OS_PoolStats_t *stats){
+  long sr = OS_StartCritical();
+  stats->blockSize = pool->blockSize;
+  stats->blocks = pool->blocks;
+  stats->used = pool->used;
+  stats->peak = pool->peak;
+  stats->allocs = pool->allocs;
+  stats->fails = pool->fails;
+  stats->badFrees = pool->badFrees;
+  OS_EndCritical(sr);
+}
+
+// ******** OS_PoolResetStats ************
+// Start the counters over; the high-water mark restarts at the
+// blocks in use now
+// Inputs:  pointer to the pool
+// Outputs: none
+void OS_PoolResetStats(OS_Pool_t *pool){
+  long sr = OS_StartCritical();
+  pool->peak = pool->used;
+  pool->allocs = 0;
+  pool->fails = 0;
+  pool->badFrees = 0;
+  OS_EndCritical(sr);
+}
+
+// ******** OS_PoolNext ************
+// Walk every pool from OS_PoolInit
+// Inputs:  NULL for the first pool, else the previous one
+// Outputs: the next pool, NULL after the last
+OS_Pool_t *OS_PoolNext(OS_Pool_t *pool){
+  return (pool == NULL) ? PoolList : pool->next;
+}
+
+// ******** OS_MailboxInit ************
+// Initialize an empty mailbox
+// Inputs:  pointer to the mailbox
+//          storage for capacity block pointers
+//          capacity, most blocks in flight
+// Outputs: 1 if successful, 0 if capacity is 0
+int OS_MailboxInit(OS_Mailbox_t *mailbox, void **slots, uint32_t capacity){
+  return OS_QueueInit(&mailbox->queue, slots, capacity, sizeof(void *));
+}
+
+// ******** OS_MailboxPost ************
+// Hand a block to the receiver, blocking while the mailbox is full.
+// The sender must not touch the block afterwards
+// Inputs:  pointer to the mailbox
+//          block to pass
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: 1 if posted, 0 if the mailbox stayed full
+int OS_MailboxPost(OS_Mailbox_t *mailbox, void *block, uint32_t timeout){
+  return OS_QueueSend(&mailbox->queue, &block, timeout);
+}
+
+// ******** OS_MailboxPostISR ************
+// Post from an ISR or periodic event, never blocks
+// Inputs:  pointer to the mailbox
+//          block to pass
+// Outputs: 1 if posted, 0 if the mailbox was full
+int OS_MailboxPostISR(OS_Mailbox_t *mailbox, void *block){
+  return OS_QueueSendISR(&mailbox->queue, &block);
+}
+
+// ******** OS_MailboxPend ************
+// Take the oldest block from a mailbox, blocking while it is empty.
+// The receiver owns the block and frees it when done
+// Inputs:  pointer to the mailbox
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: pointer to the block, NULL if the mailbox stayed empty
+void *OS_MailboxPend(OS_Mailbox_t *mailbox, uint32_t timeout){
+  void *block;
+  if(OS_QueueReceive(&mailbox->queue, &block, timeout) == 0){
+    return NULL;
+  }
+  return block;
+}
+
+#ifdef OS_BENCHMARK
+#define BENCHFRAMES 100      // frames moved by each test
+#define BENCHWORDS  16       // 64-byte frames
+uint32_t FifoBytesPerSec;    // frames copied through OS_FIFO_Put/Get
+uint32_t PoolBytesPerSec;    // frames passed as pool blocks through a mailbox
+
+// bytes per second from bytes moved in a number of core cycles
+static uint32_t rate(uint32_t bytes, uint32_t cycles){
+  return (uint32_t)(((uint64_t)bytes*BSP_Clock_GetFreq())/cycles);
+}
+
+// ******** OS_PoolBenchmark ************
+// Move 64-byte frames through OS_FIFO (copied word by word) and
+// through a pool and mailbox (pointer only) and store the throughput
+// in FifoBytesPerSec and PoolBytesPerSec. Call from a thread while
+// nothing else uses the OS_FIFO
+// Inputs:  none
+// Outputs: none
+void OS_PoolBenchmark(void){
+  static OS_POOL_MEMORY(memory, BENCHWORDS*4, 4);
+  static void *slots[4];
+  static OS_Pool_t pool;
+  static OS_Mailbox_t mailbox;
+  uint32_t frame[BENCHWORDS];
+  uint32_t start, cycles;
+  OS_PoolInit(&pool, memory, BENCHWORDS*4, 4);
+  OS_MailboxInit(&mailbox, slots, 4);
+  OS_FIFO_Init();
+  for(int i = 0; i < BENCHWORDS; i++){
+    frame[i] = i;
+  }
+
+  // the FIFO holds ten words, so each frame goes in two halves
+  start = DWT_CYCCNT;
+  for(int f = 0; f < BENCHFRAMES; f++){
+    for(int half = 0; half < BENCHWORDS; half += BENCHWORDS/2){
+      for(int i = half; i < half + BENCHWORDS/2; i++) OS_FIFO_Put(frame[i]);
+      for(int i = half; i < half + BENCHWORDS/2; i++) frame[i] = OS_FIFO_Get();
+    }
+  }
+  cycles = DWT_CYCCNT - start;
+  FifoBytesPerSec = rate(BENCHFRAMES*BENCHWORDS*4, cycles);
+
+  // the producer would fill the block in place, so only ownership moves
+  start = DWT_CYCCNT;
+  for(int f = 0; f < BENCHFRAMES; f++){
+    uint32_t *block = OS_PoolAlloc(&pool);
+    OS_MailboxPost(&mailbox, block, 0);
+    block = OS_MailboxPend(&mailbox, 0);
+    OS_PoolFree(&pool, block);
+  }
+  cycles = DWT_CYCCNT - start;
+  PoolBytesPerSec = rate(BENCHFRAMES*BENCHWORDS*4, cycles);
+}
+#endif
@@ -0,0 +1,147 @@
+// ospool.h
+// Runs on TM4C123
+// Fixed-block memory pools and a mailbox for zero-copy messages.
+// There is no heap (Heap_Size is 0), so objects created at run time,
+// like particles, link packets or render commands, come from pools
+// of equal-size blocks sized at compile time. A producer allocates a
+// block, fills it in place and posts the pointer; the consumer pends
+// on the mailbox, uses the block and frees it. Only the pointer is
+// ever copied. Every pool keeps usage counts and a high-water mark,
+// so its block count can be sized from a real run.
+
+#ifndef __OSPOOL_H
+#define __OSPOOL_H  1
+
+#include <stdint.h>
+#include "os.h"
+
+// Pool of equal-size blocks. Free blocks are linked through their
+// first word; beyond the blocks the pool needs one bit per block,
+// set while the block is allocated, so a second free is caught
+typedef struct OS_Pool{
+  void *free;          // first free block, NULL when all are in use
+  uint8_t *start;      // first block, frees are checked against
+  uint8_t *end;        // one past the last block
+  uint32_t *allocated; // bit i of word i/32 set while block i is allocated
+  uint32_t blockSize;  // bytes per block, a multiple of 4
+  uint32_t blocks;     // number of blocks
+  uint32_t used;       // blocks allocated now
+  uint32_t peak;       // high-water mark of used
+  uint32_t allocs;     // successful OS_PoolAlloc calls
+  uint32_t fails;      // OS_PoolAlloc calls that found no free block
+  uint32_t badFrees;   // OS_PoolFree calls with a block from elsewhere or free
+  struct OS_Pool *next;// every pool, newest first, for OS_PoolNext
+} OS_Pool_t;
+
+// Snapshot of a pool's use, read with OS_PoolStats
+typedef struct{
+  uint32_t blockSize;  // bytes per block
+  uint32_t blocks;     // number of blocks
+  uint32_t used;       // blocks allocated now
+  uint32_t peak;       // most blocks allocated at once
+  uint32_t allocs;     // successful allocations
+  uint32_t fails;      // allocations that found the pool empty
+  uint32_t badFrees;   // frees of blocks not from this pool or not allocated, ignored
+} OS_PoolStats_t;
+
+// Queue of block pointers, passes ownership between threads
+typedef struct{
+  OS_Queue_t queue;
+} OS_Mailbox_t;
+
+// Declare word-aligned memory for a pool of blocks and its bitmap
+#define OS_POOL_MEMORY(name, blockSize, blocks) \
+  uint32_t name[(((blockSize)+3)/4)*(blocks) + ((blocks)+31)/32]
+
+// ******** OS_PoolInit ************
+// Carve memory into blocks, link them all into the free list, clear
+// the statistics and add the pool to the list read by OS_PoolNext.
+// Every block must be free when a pool is initialized again
+// Inputs:  pointer to the pool
+//          word-aligned memory from OS_POOL_MEMORY: blocks*blockSize
+//          bytes followed by one bit per block, in whole words
+//          blockSize, bytes per block, rounded up to a multiple of 4
+//          blocks, number of blocks
+// Outputs: 1 if successful, 0 if blockSize or blocks is 0
+int OS_PoolInit(OS_Pool_t *pool, void *memory, uint32_t blockSize, uint32_t blocks);
+
+// ******** OS_PoolAlloc ************
+// Take a block from the pool in constant time, callable from ISRs
+// Inputs:  pointer to the pool
+// Outputs: pointer to the block, NULL if none is free
+void *OS_PoolAlloc(OS_Pool_t *pool);
+
+// ******** OS_PoolFree ************
+// Return a block to the pool in constant time, callable from ISRs.
+// A pointer that is not the start of one of the pool's blocks, or a
+// block that is not allocated (freed twice), is counted in badFrees
+// and ignored, so it can not corrupt the free list
+// Inputs:  pointer to the pool
+//          block from OS_PoolAlloc on the same pool, NULL is ignored
+// Outputs: none
+void OS_PoolFree(OS_Pool_t *pool, void *block);
+
+// ******** OS_PoolStats ************
+// Copy a consistent snapshot of a pool's use
+// Inputs:  pointer to the pool
+//          where to put the statistics
+// Outputs: none
+void OS_PoolStats(OS_Pool_t *pool, OS_PoolStats_t *stats);
+
+// ******** OS_PoolResetStats ************
+// Start the counters over; the high-water mark restarts at the
+// blocks in use now
+// Inputs:  pointer to the pool
+// Outputs: none
+void OS_PoolResetStats(OS_Pool_t *pool);
+
+// ******** OS_PoolNext ************
+// Walk every pool from OS_PoolInit
+// Inputs:  NULL for the first pool, else the previous one
+// Outputs: the next pool, NULL after the last
+OS_Pool_t *OS_PoolNext(OS_Pool_t *pool);
+
+// ******** OS_MailboxInit ************
+// Initialize an empty mailbox
+// Inputs:  pointer to the mailbox
+//          storage for capacity block pointers
+//          capacity, most blocks in flight
+// Outputs: 1 if successful, 0 if capacity is 0
+int OS_MailboxInit(OS_Mailbox_t *mailbox, void **slots, uint32_t capacity);
+
+// ******** OS_MailboxPost ************
+// Hand a block to the receiver, blocking while the mailbox is full.
+// The sender must not touch the block afterwards
+// Inputs:  pointer to the mailbox
+//          block to pass
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: 1 if posted, 0 if the mailbox stayed full
+int OS_MailboxPost(OS_Mailbox_t *mailbox, void *block, uint32_t timeout);
+
+// ******** OS_MailboxPostISR ************
+// Post from an ISR or periodic event, never blocks
+// Inputs:  pointer to the mailbox
+//          block to pass
+// Outputs: 1 if posted, 0 if the mailbox was full
+int OS_MailboxPostISR(OS_Mailbox_t *mailbox, void *block);
+
+// ******** OS_MailboxPend ************
+// Take the oldest block from a mailbox, blocking while it is empty.
+// The receiver owns the block and frees it when done
+// Inputs:  pointer to the mailbox
+//          timeout in ticks, 0 to not block, OS_WAITFOREVER for none
+// Outputs: pointer to the block, NULL if the mailbox stayed empty
+void *OS_MailboxPend(OS_Mailbox_t *mailbox, uint32_t timeout);
+
+#ifdef OS_BENCHMARK
+// ******** OS_PoolBenchmark ************
+// Move 64-byte frames through OS_FIFO (copied word by word) and
+// through a pool and mailbox (pointer only) and store the throughput
+// in FifoBytesPerSec and PoolBytesPerSec. Call from a thread while
+// nothing else uses the OS_FIFO
+// Inputs:  none
+// Outputs: none
+void OS_PoolBenchmark(void);
+#endif
+
+#endif
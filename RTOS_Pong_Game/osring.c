@@ -0,0 +1,210 @@
+// osring.c
+// Runs on TM4C123
+// Lock-free single-producer/single-consumer ring buffer.
+// head and tail count elements forever and wrap at 2^32, so
+// head-tail is the number stored and no slot is left empty.
+// Aligned 32-bit loads and stores are atomic on the Cortex-M4;
+// the barriers keep the compiler (and any bus master) from
+// moving element copies past the index that publishes them.
+
+#include <stdint.h>
+#include <string.h>
+#include "os.h"
+#include "osring.h"
+#include "CortexM.h"
+#include "BSP.h"
+
+#if defined(__CC_ARM)
+  #define OS_BARRIER() __dmb(0xF)
+#else
+  #define OS_BARRIER() __sync_synchronize()
+#endif
+
+// ******** OS_RingInit ************
+// Initialize an empty ring over a caller-supplied buffer
+// Inputs:  pointer to the ring
+//          buffer of capacity*size bytes, aligned for the element type
+//          capacity, number of elements, a power of two
+//          size, bytes per element
+// Outputs: 1 if successful, 0 if capacity is not a power of two
+int OS_RingInit(OS_Ring_t *ring, void *buffer, uint32_t capacity, uint32_t size){
+  if((capacity == 0) || (capacity&(capacity-1)) || (size == 0)){
+    return 0;
+  }
+  ring->buffer = (uint8_t *)buffer;
+  ring->size = size;
+  ring->mask = capacity - 1;
+  ring->head = 0;
+  ring->tail = 0;
+  ring->waiting = 0;
+  ring->lost = 0;
+  OS_SemaInit(&ring->ready, 0, OS_ORDER_FIFO);
+  return 1;
+}
+
+// ******** copyIn ************
+// Copy n elements to the ring starting at element index,
+// in two pieces when they wrap past the end of the buffer
+static void copyIn(OS_Ring_t *ring, uint32_t index, const uint8_t *src, uint32_t n){
+  uint32_t slot = index&ring->mask;
+  uint32_t first = ring->mask + 1 - slot;  // elements before the end
+  if(first > n){
+    first = n;
+  }
+  memcpy(&ring->buffer[slot*ring->size], src, first*ring->size);
+  memcpy(ring->buffer, &src[first*ring->size], (n-first)*ring->size);
+}
+
+// ******** copyOut ************
+// Copy n elements from the ring starting at element index
+static void copyOut(OS_Ring_t *ring, uint32_t index, uint8_t *dst, uint32_t n){
+  uint32_t slot = index&ring->mask;
+  uint32_t first = ring->mask + 1 - slot;
+  if(first > n){
+    first = n;
+  }
+  memcpy(dst, &ring->buffer[slot*ring->size], first*ring->size);
+  memcpy(&dst[first*ring->size], ring->buffer, (n-first)*ring->size);
+}
+
+// ******** OS_RingPut ************
+// Copy up to n elements into the ring, the producer side.
+// Never blocks, elements that do not fit are dropped and counted
+// Callable from one ISR, periodic event or thread
+// Inputs:  pointer to the ring
+//          n elements to copy in
+//          n, number of elements
+// Outputs: number of elements stored
+uint32_t OS_RingPut(OS_Ring_t *ring, const void *data, uint32_t n){
+  uint32_t head = ring->head;              // only the producer writes it
+  uint32_t space = ring->mask + 1 - (head - ring->tail);
+  if(n > space){
+    ring->lost += n - space;
+    n = space;
+  }
+  if(n == 0){
+    return 0;
+  }
+  copyIn(ring, head, (const uint8_t *)data, n);
+  OS_BARRIER();                  // elements are written before head says so
+  ring->head = head + n;
+  OS_BARRIER();                  // head is visible before we look for a sleeper
+  if(ring->waiting){
+    ring->waiting = 0;
+    OS_SemaSignal(&ring->ready);
+  }
+  return n;
+}
+
+// ******** OS_RingGet ************
+// Copy up to n elements out of the ring without blocking
+// Inputs:  pointer to the ring
+//          room for n elements
+//          n, most elements wanted
+// Outputs: number of elements copied, 0 if the ring was empty
+uint32_t OS_RingGet(OS_Ring_t *ring, void *data, uint32_t n){
+  uint32_t tail = ring->tail;              // only the consumer writes it
+  uint32_t count = ring->head - tail;
+  if(n > count){
+    n = count;
+  }
+  if(n == 0){
+    return 0;
+  }
+  OS_BARRIER();                  // head is read before the elements it covers
+  copyOut(ring, tail, (uint8_t *)data, n);
+  OS_BARRIER();                  // copied out before the producer may reuse them
+  ring->tail = tail + n;
+  return n;
+}
+
+// ******** OS_RingGetWait ************
+// Copy up to n elements out of the ring, blocking while it is empty
+// Only one thread may consume, never call from an ISR
+// Inputs:  pointer to the ring
+//          room for n elements
+//          n, most elements wanted, at least 1
+// Outputs: number of elements copied, at least 1
+uint32_t OS_RingGetWait(OS_Ring_t *ring, void *data, uint32_t n){
+  uint32_t got;
+  if(n == 0){
+    return 0;
+  }
+  while((got = OS_RingGet(ring, data, n)) == 0){
+    // Announce the wait, then look again: a put that missed the flag
+    // is seen here, a put after it signals. A signal left over from a
+    // put we did not need only costs one more trip round the loop
+    ring->waiting = 1;
+    OS_BARRIER();
+    if(ring->head != ring->tail){
+      ring->waiting = 0;
+      continue;
+    }
+    OS_SemaWait(&ring->ready);
+  }
+  return got;
+}
+
+// ******** OS_RingCount ************
+// Number of elements in the ring right now
+// Inputs:  pointer to the ring
+// Outputs: elements waiting to be taken
+uint32_t OS_RingCount(OS_Ring_t *ring){
+  return ring->head - ring->tail;
+}
+
+#ifdef OS_BENCHMARK
+#define BENCHROUNDS 100      // rounds of each test
+#define BENCHBATCH  10       // elements per round, the OS_FIFO holds ten
+uint32_t FifoElementsPerSec;      // OS_FIFO_Put/Get, one element per call
+uint32_t RingElementsPerSec;      // OS_RingPut/Get, one element per call
+uint32_t RingBatchElementsPerSec; // OS_RingPut/Get, BENCHBATCH per call
+
+// elements per second from elements moved in a number of core cycles
+static uint32_t rate(uint32_t elements, uint32_t cycles){
+  return (uint32_t)(((uint64_t)elements*BSP_Clock_GetFreq())/cycles);
+}
+
+// ******** OS_RingBenchmark ************
+// Stream elements through OS_FIFO and through an OS_Ring_t and store
+// the throughput in FifoElementsPerSec, RingElementsPerSec and
+// RingBatchElementsPerSec. Call from a thread while nothing else
+// uses the OS_FIFO
+// Inputs:  none
+// Outputs: none
+void OS_RingBenchmark(void){
+  static uint32_t buffer[16];
+  static OS_Ring_t ring;
+  uint32_t data[BENCHBATCH];
+  uint32_t start, cycles;
+  OS_RingInit(&ring, buffer, 16, sizeof(uint32_t));
+  OS_FIFO_Init();
+  for(int i = 0; i < BENCHBATCH; i++){
+    data[i] = i;
+  }
+
+  start = DWT_CYCCNT;
+  for(int r = 0; r < BENCHROUNDS; r++){
+    for(int i = 0; i < BENCHBATCH; i++) OS_FIFO_Put(data[i]);
+    for(int i = 0; i < BENCHBATCH; i++) data[i] = OS_FIFO_Get();
+  }
+  cycles = DWT_CYCCNT - start;
+  FifoElementsPerSec = rate(BENCHROUNDS*BENCHBATCH, cycles);
+
+  start = DWT_CYCCNT;
+  for(int r = 0; r < BENCHROUNDS; r++){
+    for(int i = 0; i < BENCHBATCH; i++) OS_RingPut(&ring, &data[i], 1);
+    for(int i = 0; i < BENCHBATCH; i++) OS_RingGet(&ring, &data[i], 1);
+  }
+  cycles = DWT_CYCCNT - start;
+  RingElementsPerSec = rate(BENCHROUNDS*BENCHBATCH, cycles);
+
+  start = DWT_CYCCNT;
+  for(int r = 0; r < BENCHROUNDS; r++){
+    OS_RingPut(&ring, data, BENCHBATCH);
+    OS_RingGet(&ring, data, BENCHBATCH);
+  }
+  cycles = DWT_CYCCNT - start;
+  RingBatchElementsPerSec = rate(BENCHROUNDS*BENCHBATCH, cycles);
+}
+#endif
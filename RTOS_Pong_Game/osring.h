@@ -0,0 +1,78 @@
+// osring.h
+// Runs on TM4C123
+// Lock-free single-producer/single-consumer ring buffer for streams
+// from an ISR or periodic event to a thread. One side only writes
+// head, the other only writes tail, so neither disables interrupts.
+// Capacity is a power of two, indices are masked instead of divided.
+
+#ifndef __OSRING_H
+#define __OSRING_H  1
+
+#include <stdint.h>
+#include "os.h"
+
+typedef struct{
+  uint8_t *buffer;           // capacity*size bytes, supplied by the caller
+  uint32_t size;             // bytes per element
+  uint32_t mask;             // capacity-1
+  volatile uint32_t head;    // elements ever put, written by the producer
+  volatile uint32_t tail;    // elements ever taken, written by the consumer
+  volatile uint32_t waiting; // consumer is about to block in OS_RingGetWait
+  uint32_t lost;             // elements dropped because the ring was full
+  Sema_t ready;              // consumer blocks here when the ring is empty
+} OS_Ring_t;
+
+// ******** OS_RingInit ************
+// Initialize an empty ring over a caller-supplied buffer
+// Inputs:  pointer to the ring
+//          buffer of capacity*size bytes, aligned for the element type
+//          capacity, number of elements, a power of two
+//          size, bytes per element
+// Outputs: 1 if successful, 0 if capacity is not a power of two
+int OS_RingInit(OS_Ring_t *ring, void *buffer, uint32_t capacity, uint32_t size);
+
+// ******** OS_RingPut ************
+// Copy up to n elements into the ring, the producer side.
+// Never blocks, elements that do not fit are dropped and counted
+// Callable from one ISR, periodic event or thread
+// Inputs:  pointer to the ring
+//          n elements to copy in
+//          n, number of elements
+// Outputs: number of elements stored
+uint32_t OS_RingPut(OS_Ring_t *ring, const void *data, uint32_t n);
+
+// ******** OS_RingGet ************
+// Copy up to n elements out of the ring without blocking
+// Inputs:  pointer to the ring
+//          room for n elements
+//          n, most elements wanted
+// Outputs: number of elements copied, 0 if the ring was empty
+uint32_t OS_RingGet(OS_Ring_t *ring, void *data, uint32_t n);
+
+// ******** OS_RingGetWait ************
+// Copy up to n elements out of the ring, blocking while it is empty
+// Only one thread may consume, never call from an ISR
+// Inputs:  pointer to the ring
+//          room for n elements
+//          n, most elements wanted, at least 1
+// Outputs: number of elements copied, at least 1
+uint32_t OS_RingGetWait(OS_Ring_t *ring, void *data, uint32_t n);
+
+// ******** OS_RingCount ************
+// Number of elements in the ring right now
+// Inputs:  pointer to the ring
+// Outputs: elements waiting to be taken
+uint32_t OS_RingCount(OS_Ring_t *ring);
+
+#ifdef OS_BENCHMARK
+// ******** OS_RingBenchmark ************
+// Stream elements through OS_FIFO and through an OS_Ring_t and store
+// the throughput in FifoElementsPerSec, RingElementsPerSec and
+// RingBatchElementsPerSec. Call from a thread while nothing else
+// uses the OS_FIFO
+// Inputs:  none
+// Outputs: none
+void OS_RingBenchmark(void);
+#endif
+
+#endif
@@ -0,0 +1,184 @@
+// osstats.c
+// Runs on TM4C123
+// Runtime timing probes. Each sample updates running min, max and
+// sum and one histogram bin in a short critical section, so probes
+// work from ISRs and periodic events and can be read at any time.
+// Intervals are CYCCNT differences, good up to 2^32 cycles (53 s).
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "os.h"
+#include "osstats.h"
+#include "CortexM.h"
+#include "BSP.h"
+
+static OS_Probe_t *ProbeList;    // every probe, newest first
+static uint32_t ProbeCyclesPerUs = 80;
+
+// ******** seriesClear ************
+static void seriesClear(OS_Series_t *series){
+  series->count = 0;
+  series->min = 0xFFFFFFFF;
+  series->max = 0;
+  series->sum = 0;
+  for(int i = 0; i < OS_HISTBINS; i++){
+    series->hist[i] = 0;
+  }
+}
+
+// ******** seriesAdd ************
+// Add one sample in cycles, called with interrupts disabled
+static void seriesAdd(OS_Series_t *series, uint32_t cycles){
+  uint32_t us = cycles/ProbeCyclesPerUs;
+  uint32_t bin = (us == 0) ? 0 : 32 - OS_CLZ(us);  // log2, one instruction
+  if(bin >= OS_HISTBINS){
+    bin = OS_HISTBINS - 1;
+  }
+  series->hist[bin]++;
+  series->count++;
+  series->sum += cycles;
+  if(cycles < series->min) series->min = cycles;
+  if(cycles > series->max) series->max = cycles;
+}
+
+// ******** seriesRead ************
+// Convert a series to microseconds, the Grader's min/max/ave/jitter
+static void seriesRead(OS_Series_t *series, OS_SeriesResult_t *result){
+  result->count = series->count;
+  if(series->count == 0){
+    result->min = result->max = result->mean = result->jitter = 0;
+  } else{
+    result->min = series->min/ProbeCyclesPerUs;
+    result->max = series->max/ProbeCyclesPerUs;
+    result->mean = (uint32_t)(series->sum/series->count/ProbeCyclesPerUs);
+    result->jitter = (series->max - series->min)/ProbeCyclesPerUs;
+  }
+  for(int i = 0; i < OS_HISTBINS; i++){
+    result->hist[i] = series->hist[i];
+  }
+}
+
+// ******** OS_ProbeInit ************
+// Clear a probe and add it to the list read by OS_ProbeNext
+// Inputs:  pointer to the probe, static or global
+//          name for the debugger and for printing
+//          expected period in usec, 0 if the probed code is not periodic
+// Outputs: none
+void OS_ProbeInit(OS_Probe_t *probe, const char *name, uint32_t periodUs){
+  ProbeCyclesPerUs = BSP_Clock_GetFreq()/1000000;
+  probe->name = name;
+  probe->expected = periodUs*ProbeCyclesPerUs;
+  OS_ProbeReset(probe);
+  long sr = OS_StartCritical();
+  probe->next = ProbeList;
+  ProbeList = probe;
+  OS_EndCritical(sr);
+}
+
+// ******** OS_ProbeRelease ************
+// Mark the moment the probed thread's work became due, for example
+// in the ISR or event that signals it. Callable from ISRs
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeRelease(OS_Probe_t *probe){
+  long sr = OS_StartCritical();
+  if(!probe->released){          // the oldest pending release counts
+    probe->release = DWT_CYCCNT;
+    probe->released = 1;
+  }
+  OS_EndCritical(sr);
+}
+
+// ******** OS_ProbeStart ************
+// The probed thread starts a run; records the latency from the
+// pending release, if any, and the period from the previous start
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeStart(OS_Probe_t *probe){
+  long sr = OS_StartCritical();
+  uint32_t now = DWT_CYCCNT;
+  if(probe->released){
+    seriesAdd(&probe->latency, now - probe->release);
+    probe->released = 0;
+  }
+  if(probe->started){
+    seriesAdd(&probe->period, now - probe->lastStart);
+  }
+  probe->start = now;
+  probe->lastStart = now;
+  probe->started = 1;
+  OS_EndCritical(sr);
+}
+
+// ******** OS_ProbeEnd ************
+// The probed thread finished the run begun by OS_ProbeStart
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeEnd(OS_Probe_t *probe){
+  long sr = OS_StartCritical();
+  seriesAdd(&probe->exec, DWT_CYCCNT - probe->start);
+  OS_EndCritical(sr);
+}
+
+// ******** OS_ProbeSample ************
+// Record one whole run from its three time stamps, used by the
+// kernel for periodic events
+// Inputs:  pointer to the probe
+//          release, start and end as CYCCNT values
+// Outputs: none
+void OS_ProbeSample(OS_Probe_t *probe, uint32_t release, uint32_t start, uint32_t end){
+  long sr = OS_StartCritical();
+  seriesAdd(&probe->latency, start - release);
+  seriesAdd(&probe->exec, end - start);
+  if(probe->started){
+    seriesAdd(&probe->period, start - probe->lastStart);
+  }
+  probe->lastStart = start;
+  probe->started = 1;
+  OS_EndCritical(sr);
+}
+
+// ******** OS_ProbeRead ************
+// Snapshot a probe in microseconds while it keeps running
+// Inputs:  pointer to the probe
+//          where to put the results
+// Outputs: none
+void OS_ProbeRead(OS_Probe_t *probe, OS_ProbeResult_t *result){
+  OS_Series_t latency, exec, period;
+  long sr = OS_StartCritical();     // a consistent copy, then convert
+  latency = probe->latency;
+  exec = probe->exec;
+  period = probe->period;
+  OS_EndCritical(sr);
+  seriesRead(&latency, &result->latency);
+  seriesRead(&exec, &result->exec);
+  seriesRead(&period, &result->period);
+  result->err = 0;
+  if((probe->expected != 0) && (period.count != 0)){
+    uint32_t ave = (uint32_t)(period.sum/period.count);
+    uint32_t diff = (ave >= probe->expected) ? ave - probe->expected : probe->expected - ave;
+    result->err = (uint32_t)(((uint64_t)1000*diff)/probe->expected);
+  }
+}
+
+// ******** OS_ProbeReset ************
+// Start a probe's statistics over, keeping its name and period
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeReset(OS_Probe_t *probe){
+  long sr = OS_StartCritical();
+  probe->released = 0;
+  probe->started = 0;
+  seriesClear(&probe->latency);
+  seriesClear(&probe->exec);
+  seriesClear(&probe->period);
+  OS_EndCritical(sr);
+}
+
+// ******** OS_ProbeNext ************
+// Walk every probe from OS_ProbeInit
+// Inputs:  NULL for the first probe, else the previous one
+// Outputs: the next probe, NULL after the last
+OS_Probe_t *OS_ProbeNext(OS_Probe_t *probe){
+  return (probe == NULL) ? ProbeList : probe->next;
+}
@@ -0,0 +1,124 @@
+// osstats.h
+// Runs on TM4C123
+// Runtime timing probes, the TExaS Grader's min/max/jitter/average
+// math kept as running totals so it can be read at any time without
+// stopping the system. A probe follows one periodic event or thread:
+// release-to-start latency, execution time and start-to-start period,
+// each with min, max, mean, jitter (max-min) and a log2 histogram.
+// Periodic events are timed by the kernel once a probe is attached;
+// threads call OS_ProbeRelease, OS_ProbeStart and OS_ProbeEnd.
+
+#ifndef __OSSTATS_H
+#define __OSSTATS_H  1
+
+#include <stdint.h>
+#include "os.h"
+
+// bin 0 counts samples under 1 us, bin k counts 2^(k-1) to 2^k-1 us,
+// the last bin everything from 2^(OS_HISTBINS-2) us up (262 ms)
+#define OS_HISTBINS 20
+
+// One measured quantity, kept in core cycles
+typedef struct{
+  uint32_t count;              // samples
+  uint32_t min;                // fewest cycles seen
+  uint32_t max;                // most cycles seen
+  uint64_t sum;                // mean = sum/count
+  uint32_t hist[OS_HISTBINS];  // samples per log2 range of microseconds
+} OS_Series_t;
+
+typedef struct OS_Probe{
+  const char *name;            // shown by the debugger
+  struct OS_Probe *next;       // all probes, newest first
+  uint32_t expected;           // period in cycles, 0 if not periodic
+  uint32_t release;            // CYCCNT of the pending release
+  uint32_t start;              // CYCCNT when the current run started
+  uint32_t lastStart;          // CYCCNT when the previous run started
+  uint32_t released;           // a release is waiting for its start
+  uint32_t started;            // lastStart is valid
+  OS_Series_t latency;         // release to start
+  OS_Series_t exec;            // start to end
+  OS_Series_t period;          // start to next start, the Grader's dt
+} OS_Probe_t;
+
+// One series in microseconds, as the Grader prints it
+typedef struct{
+  uint32_t count;              // samples
+  uint32_t min;                // us
+  uint32_t max;                // us
+  uint32_t mean;               // us
+  uint32_t jitter;             // max-min, us
+  uint32_t hist[OS_HISTBINS];  // copy of the histogram
+} OS_SeriesResult_t;
+
+typedef struct{
+  OS_SeriesResult_t latency;
+  OS_SeriesResult_t exec;
+  OS_SeriesResult_t period;
+  uint32_t err;                // |mean period - expected| in 0.1% of expected
+} OS_ProbeResult_t;
+
+// ******** OS_ProbeInit ************
+// Clear a probe and add it to the list read by OS_ProbeNext
+// Inputs:  pointer to the probe, static or global
+//          name for the debugger and for printing
+//          expected period in usec, 0 if the probed code is not periodic
+// Outputs: none
+void OS_ProbeInit(OS_Probe_t *probe, const char *name, uint32_t periodUs);
+
+// ******** OS_ProbeAttach ************
+// Let the kernel time a periodic event: release to start is its
+// lateness, start to end its run, so the event itself needs no calls
+// Inputs:  event number, 0 for the first one added
+//          probe from OS_ProbeInit, NULL to detach
+// Outputs: 1 if successful, 0 if there is no such event
+int OS_ProbeAttach(uint32_t event, OS_Probe_t *probe);
+
+// ******** OS_ProbeRelease ************
+// Mark the moment the probed thread's work became due, for example
+// in the ISR or event that signals it. Callable from ISRs
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeRelease(OS_Probe_t *probe);
+
+// ******** OS_ProbeStart ************
+// The probed thread starts a run; records the latency from the
+// pending release, if any, and the period from the previous start
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeStart(OS_Probe_t *probe);
+
+// ******** OS_ProbeEnd ************
+// The probed thread finished the run begun by OS_ProbeStart
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeEnd(OS_Probe_t *probe);
+
+// ******** OS_ProbeSample ************
+// Record one whole run from its three time stamps, used by the
+// kernel for periodic events
+// Inputs:  pointer to the probe
+//          release, start and end as CYCCNT values
+// Outputs: none
+void OS_ProbeSample(OS_Probe_t *probe, uint32_t release, uint32_t start, uint32_t end);
+
+// ******** OS_ProbeRead ************
+// Snapshot a probe in microseconds while it keeps running
+// Inputs:  pointer to the probe
+//          where to put the results
+// Outputs: none
+void OS_ProbeRead(OS_Probe_t *probe, OS_ProbeResult_t *result);
+
+// ******** OS_ProbeReset ************
+// Start a probe's statistics over, keeping its name and period
+// Inputs:  pointer to the probe
+// Outputs: none
+void OS_ProbeReset(OS_Probe_t *probe);
+
+// ******** OS_ProbeNext ************
+// Walk every probe from OS_ProbeInit
+// Inputs:  NULL for the first probe, else the previous one
+// Outputs: the next probe, NULL after the last
+OS_Probe_t *OS_ProbeNext(OS_Probe_t *probe);
+
+#endif
@@ -0,0 +1,328 @@
+// ostimer.c
+// Runs on TM4C123
+// Software timers in a hierarchical timing wheel, four levels of 64
+// slots. A timer due within 64 ticks sits in level 0 at its own tick,
+// one due within 64^2 ticks in level 1 at its 64-tick lap, and so on.
+// Each time a level's lap ends its slot is cascaded, its timers move
+// down toward level 0, so start and stop only link or unlink one node
+// and a timer is touched at most four times before it expires.
+// A bitmap per level finds the next slot with work, so the daemon
+// sleeps in OS_FlagsWait until then instead of looking at every tick,
+// and the kernel's tickless idle sees its wake time like any sleeper.
+// Every critical section covers one timer, so ISRs wait at most that.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "os.h"
+#include "ostimer.h"
+#include "CortexM.h"
+#include "BSP.h"
+
+#define LEVELS    4          // 6 bits each, OS_TIMER_MAXTICKS is 24 bits
+#define SLOTBITS  6
+#define SLOTS     64         // per level
+#ifndef TIMERSTACKBYTES
+#define TIMERSTACKBYTES 512  // the daemon's stack, callbacks run on it
+#endif
+#define TIMER_WAKE 0x01      // TimerWake flag, an earlier expiry was started
+
+static OS_Timer_t *Wheel[LEVELS*SLOTS]; // slot heads, level*SLOTS + index
+static uint32_t Occupied[LEVELS][2];    // bit i of a level set if slot i is not empty
+static uint32_t WheelNow;    // last tick the daemon has processed
+static uint32_t WakeAt;      // tick the daemon sleeps until
+static OS_Flags_t TimerWake; // wakes the daemon before WakeAt
+static OS_Timer_t *Running;  // timer whose callback runs, NULL once it may be freed
+static OS_STACK(TimerStack, TIMERSTACKBYTES);
+
+// ******** WheelInsert ************
+// Link a timer into the slot for its expiry, seen from WheelNow.
+// An expiry beyond the wheel, only possible while the daemon is far
+// behind, goes in the top level slot that is cascaded before it
+// Called with interrupts disabled
+static void WheelInsert(OS_Timer_t *timer){
+  uint32_t when = timer->expiry;
+  uint32_t delta = when - WheelNow;
+  if(delta > OS_TIMER_MAXTICKS){
+    delta = OS_TIMER_MAXTICKS;
+    when = WheelNow + OS_TIMER_MAXTICKS;
+  }
+  uint32_t level = 0;
+  while((level < LEVELS - 1) && (delta >= (1u<<(SLOTBITS*(level + 1))))){
+    level++;
+  }
+  uint32_t index = (when>>(SLOTBITS*level))&(SLOTS - 1);
+  uint32_t slot = level*SLOTS + index;
+  timer->prev = NULL;
+  timer->next = Wheel[slot];
+  if(timer->next != NULL){
+    timer->next->prev = timer;
+  }
+  Wheel[slot] = timer;
+  Occupied[level][index>>5] |= 1u<<(index&31);
+  timer->slot = (uint16_t)slot;
+  timer->armed = 1;
+}
+
+// ******** WheelRemove ************
+// Unlink an armed timer from its slot
+// Called with interrupts disabled
+static void WheelRemove(OS_Timer_t *timer){
+  uint32_t slot = timer->slot;
+  if(timer->prev == NULL){
+    Wheel[slot] = timer->next;
+  } else{
+    timer->prev->next = timer->next;
+  }
+  if(timer->next != NULL){
+    timer->next->prev = timer->prev;
+  }
+  if(Wheel[slot] == NULL){
+    uint32_t index = slot&(SLOTS - 1);
+    Occupied[slot/SLOTS][index>>5] &= ~(1u<<(index&31));
+  }
+  timer->armed = 0;
+}
+
+// ******** FirstFrom ************
+// Slots from index from, going round, to the first occupied one
+// Inputs:  bitmap of one level, first index to look at
+// Outputs: 0 to 63, or SLOTS if the level is empty
+static uint32_t FirstFrom(const uint32_t map[2], uint32_t from){
+  uint32_t word = from>>5;
+  uint32_t bits = map[word]&(0xFFFFFFFF<<(from&31));
+  for(uint32_t k = 0; k < 3; k++){  // rest of this word, the other, the start of this
+    if(bits != 0){
+      uint32_t index = word*32 + 31 - OS_CLZ(bits&(~bits + 1));
+      return (index - from)&(SLOTS - 1);
+    }
+    word ^= 1;
+    bits = map[word];
+  }
+  return SLOTS;
+}
+
+// ******** NextWork ************
+// Ticks after WheelNow to the next tick with a slot to expire or cascade
+// Called with interrupts disabled
+// Outputs: 0 if the wheel is empty
+static uint32_t NextWork(void){
+  uint32_t soonest = 0;
+  for(uint32_t level = 0; level < LEVELS; level++){
+    uint32_t shift = SLOTBITS*level;
+    uint32_t lap = (WheelNow>>shift) + 1;  // next slot of this level to come up
+    uint32_t d = FirstFrom(Occupied[level], lap&(SLOTS - 1));
+    if(d < SLOTS){
+      uint32_t ticks = ((lap + d)<<shift) - WheelNow;
+      if((soonest == 0) || (ticks < soonest)){
+        soonest = ticks;
+      }
+    }
+  }
+  return soonest;
+}
+
+// ******** Cascade ************
+// Move every timer in a slot whose lap has ended to the level below
+static void Cascade(uint32_t slot){
+  while(1){
+    long sr = OS_StartCritical();
+    OS_Timer_t *timer = Wheel[slot];
+    if(timer == NULL){
+      OS_EndCritical(sr);
+      return;
+    }
+    WheelRemove(timer);
+    WheelInsert(timer);          // lands in a lower level, never back here
+    OS_EndCritical(sr);
+  }
+}
+
+// ******** Expire ************
+// Run every timer in the level 0 slot of WheelNow. A periodic timer
+// is rearmed before its callback runs, at its next expiry still in
+// the future, so the callback may stop or restart it
+static void Expire(uint32_t slot){
+  while(1){
+    long sr = OS_StartCritical();
+    OS_Timer_t *timer = Wheel[slot];
+    if(timer == NULL){
+      OS_EndCritical(sr);
+      return;
+    }
+    WheelRemove(timer);
+    uint32_t now = (uint32_t)OS_TickCount();
+    uint32_t late = now - timer->expiry;
+    timer->stats.runs++;
+    timer->stats.totalLate += late;
+    if(late > timer->stats.maxLate){
+      timer->stats.maxLate = late;
+    }
+    if(timer->period != 0){
+      timer->expiry += timer->period;   // absolute, does not drift
+      while((int32_t)(timer->expiry - now) <= 0){
+        timer->expiry += timer->period; // rare, only after a long stall
+        timer->stats.missed++;
+      }
+      WheelInsert(timer);
+    }
+    void(*callback)(void *) = timer->callback;
+    void *arg = timer->arg;
+    Running = timer;
+    OS_EndCritical(sr);
+    uint64_t start = OS_TimeUs();
+    callback(arg);
+    uint64_t exec = OS_TimeUs() - start;
+    sr = OS_StartCritical();
+    if(Running == timer){        // not stopped or reused meanwhile, still ours
+      if(exec > timer->stats.maxExec){
+        timer->stats.maxExec = (exec > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)exec;
+      }
+      Running = NULL;
+    }
+    OS_EndCritical(sr);
+  }
+}
+
+// ******** TimerDaemon ************
+// Kernel thread of the timer service. Steps WheelNow straight to each
+// tick with work up to the current tick, then sleeps until the next
+// one or until OS_TimerStart arms an earlier timer
+static void TimerDaemon(void){
+  while(1){
+    long sr = OS_StartCritical();
+    uint32_t now = (uint32_t)OS_TickCount();
+    uint32_t next = NextWork();
+    if((next != 0) && (next <= now - WheelNow)){
+      WheelNow += next;
+      WakeAt = WheelNow;         // timers started meanwhile expire later
+      OS_EndCritical(sr);
+      for(uint32_t level = LEVELS - 1; level > 0; level--){
+        uint32_t shift = SLOTBITS*level;
+        if((WheelNow&((1u<<shift) - 1)) == 0){  // end of a lap, top level first
+          Cascade(level*SLOTS + ((WheelNow>>shift)&(SLOTS - 1)));
+        }
+      }
+      Expire(WheelNow&(SLOTS - 1));
+      continue;
+    }
+    WheelNow = now;              // nothing due up to now
+    next = NextWork();
+    uint32_t timeout = OS_WAITFOREVER;
+    WakeAt = now + 0x7FFFFFFF;   // any timer started is earlier
+    if(next != 0){
+      timeout = next;
+      WakeAt = now + next;
+    }
+    OS_EndCritical(sr);
+    OS_FlagsWait(&TimerWake, TIMER_WAKE, OS_FLAGS_ANY|OS_FLAGS_CLEAR, timeout);
+  }
+}
+
+// ******** OS_TimerServiceStart ************
+// Empty the wheel and create the timer daemon thread, before or
+// after OS_Launch and before any timer is started. The daemon
+// sleeps until the next expiry, so idle timers cost no CPU
+// Inputs:  priority of the daemon, 0 is highest, 7 is lowest;
+//          callbacks are late by however long higher threads run
+// Outputs: 1 if successful, 0 if the thread could not be created
+int OS_TimerServiceStart(uint32_t priority){
+  for(uint32_t i = 0; i < LEVELS*SLOTS; i++){
+    Wheel[i] = NULL;
+  }
+  for(uint32_t level = 0; level < LEVELS; level++){
+    Occupied[level][0] = 0;
+    Occupied[level][1] = 0;
+  }
+  WheelNow = (uint32_t)OS_TickCount();
+  WakeAt = WheelNow;
+  OS_FlagsInit(&TimerWake, 0);
+  return OS_CreateThread((void(*)(void *))&TimerDaemon, NULL,
+                         TimerStack, sizeof(TimerStack), priority);
+}
+
+// ******** OS_TimerInit ************
+// Set up a stopped timer
+// Inputs:  pointer to the timer
+//          callback, runs in the daemon each time the timer expires
+//          arg passed to callback
+// Outputs: none
+void OS_TimerInit(OS_Timer_t *timer, void(*callback)(void *), void *arg){
+  long sr = OS_StartCritical();
+  if(Running == timer){          // a block reused while its old callback runs
+    Running = NULL;
+  }
+  OS_EndCritical(sr);
+  timer->next = NULL;
+  timer->prev = NULL;
+  timer->callback = callback;
+  timer->arg = arg;
+  timer->expiry = 0;
+  timer->period = 0;
+  timer->slot = 0;
+  timer->armed = 0;
+  timer->stats.runs = 0;
+  timer->stats.missed = 0;
+  timer->stats.maxLate = 0;
+  timer->stats.totalLate = 0;
+  timer->stats.maxExec = 0;
+}
+
+// ******** OS_TimerStart ************
+// Arm a timer, or rearm it if it is already running, in O(1).
+// Callable from threads, ISRs and timer callbacks
+// Inputs:  pointer to the timer
+//          delay, ticks until the first expiry, 0 counts as 1
+//          period, ticks between later expiries, 0 for one-shot
+// Outputs: 1 if successful, 0 if delay or period is over OS_TIMER_MAXTICKS
+int OS_TimerStart(OS_Timer_t *timer, uint32_t delay, uint32_t period){
+  if((delay > OS_TIMER_MAXTICKS) || (period > OS_TIMER_MAXTICKS)){
+    return 0;
+  }
+  if(delay == 0){
+    delay = 1;                   // the current tick may be processed already
+  }
+  long sr = OS_StartCritical();
+  if(timer->armed){
+    WheelRemove(timer);
+  }
+  timer->expiry = (uint32_t)OS_TickCount() + delay;
+  timer->period = period;
+  WheelInsert(timer);
+  if((int32_t)(timer->expiry - WakeAt) < 0){
+    WakeAt = timer->expiry;
+    OS_FlagsSet(&TimerWake, TIMER_WAKE);  // sleeping past it, wake the daemon
+  }
+  OS_EndCritical(sr);
+  return 1;
+}
+
+// ******** OS_TimerStop ************
+// Disarm a timer in O(1). Its callback will not run again
+// unless it is restarted, one already running finishes but its
+// time is not added to maxExec
+// Callable from threads, ISRs and timer callbacks
+// Inputs:  pointer to the timer
+// Outputs: 1 if the timer was armed, 0 if it was stopped already
+int OS_TimerStop(OS_Timer_t *timer){
+  long sr = OS_StartCritical();
+  int wasArmed = timer->armed;
+  if(wasArmed){
+    WheelRemove(timer);
+  }
+  if(Running == timer){          // its callback may free it, leave it alone
+    Running = NULL;
+  }
+  OS_EndCritical(sr);
+  return wasArmed;
+}
+
+// ******** OS_TimerStats ************
+// Copy the timing record of a timer
+// Inputs:  pointer to the timer
+//          where to put the record
+// Outputs: none
+void OS_TimerStats(OS_Timer_t *timer, OS_TimerStats_t *stats){
+  long sr = OS_StartCritical();
+  *stats = timer->stats;
+  OS_EndCritical(sr);
+}
@@ -0,0 +1,87 @@
+// ostimer.h
+// Runs on TM4C123
+// Software timers: any number of one-shot and periodic timers in a
+// hierarchical timing wheel. Start, stop and restart are O(1) and
+// callable from threads, ISRs and timer callbacks. Callbacks run in
+// a timer daemon thread, never in SysTick, so they may take their
+// time, signal, send or even block (delaying only later timers).
+// Times are in ticks, the OS_Launch time slice.
+
+#ifndef __OSTIMER_H
+#define __OSTIMER_H  1
+
+#include <stdint.h>
+#include "os.h"
+
+#define OS_TIMER_MAXTICKS 0x00FFFFFF  // longest delay or period, 4.6 h at 1 ms
+
+// Timing record of a timer, read with OS_TimerStats
+typedef struct{
+  uint32_t runs;       // callbacks made
+  uint32_t missed;     // periodic expiries skipped, the daemon was a
+                       // whole period or more behind
+  uint32_t maxLate;    // most ticks from expiry to callback
+  uint32_t totalLate;  // sum of the ticks late, average is totalLate/runs
+  uint32_t maxExec;    // longest callback, usec
+} OS_TimerStats_t;
+
+// One timer, owned by the caller (static, or a block from an OS_Pool).
+// Armed timers are linked into a wheel slot, so the wheel needs no
+// memory beyond its slot heads. The daemon writes maxExec after the
+// callback returns, so a callback that frees its own timer must
+// OS_TimerStop it first; a stopped one-shot just returns 0
+typedef struct OS_Timer{
+  struct OS_Timer *next;       // in its wheel slot while armed
+  struct OS_Timer *prev;       // NULL at the head of the slot
+  void(*callback)(void *arg);  // runs in the timer daemon
+  void *arg;                   // passed to callback
+  uint32_t expiry;             // tick it is due, low 32 bits of OS_TickCount
+  uint32_t period;             // ticks between expiries, 0 for one-shot
+  uint16_t slot;               // wheel slot while armed
+  uint16_t armed;              // 1 while in the wheel
+  OS_TimerStats_t stats;
+} OS_Timer_t;
+
+// ******** OS_TimerServiceStart ************
+// Empty the wheel and create the timer daemon thread, before or
+// after OS_Launch and before any timer is started. The daemon
+// sleeps until the next expiry, so idle timers cost no CPU
+// Inputs:  priority of the daemon, 0 is highest, 7 is lowest;
+//          callbacks are late by however long higher threads run
+// Outputs: 1 if successful, 0 if the thread could not be created
+int OS_TimerServiceStart(uint32_t priority);
+
+// ******** OS_TimerInit ************
+// Set up a stopped timer
+// Inputs:  pointer to the timer
+//          callback, runs in the daemon each time the timer expires
+//          arg passed to callback
+// Outputs: none
+void OS_TimerInit(OS_Timer_t *timer, void(*callback)(void *), void *arg);
+
+// ******** OS_TimerStart ************
+// Arm a timer, or rearm it if it is already running, in O(1).
+// Callable from threads, ISRs and timer callbacks
+// Inputs:  pointer to the timer
+//          delay, ticks until the first expiry, 0 counts as 1
+//          period, ticks between later expiries, 0 for one-shot
+// Outputs: 1 if successful, 0 if delay or period is over OS_TIMER_MAXTICKS
+int OS_TimerStart(OS_Timer_t *timer, uint32_t delay, uint32_t period);
+
+// ******** OS_TimerStop ************
+// Disarm a timer in O(1). Its callback will not run again
+// unless it is restarted, one already running finishes but its
+// time is not added to maxExec
+// Callable from threads, ISRs and timer callbacks
+// Inputs:  pointer to the timer
+// Outputs: 1 if the timer was armed, 0 if it was stopped already
+int OS_TimerStop(OS_Timer_t *timer);
+
+// ******** OS_TimerStats ************
+// Copy the timing record of a timer
+// Inputs:  pointer to the timer
+//          where to put the record
+// Outputs: none
+void OS_TimerStats(OS_Timer_t *timer, OS_TimerStats_t *stats);
+
+#endif
@@ -0,0 +1,88 @@
+// ostrace.c
+// Runs on TM4C123
+// Kernel event trace ring and its UART0 dump.
+// The trace points themselves are the OS_TRACE_POINT macro in
+// ostrace.h, so they inline into the kernel with no call.
+
+#include <stdint.h>
+#include "os.h"
+#include "ostrace.h"
+#include "CortexM.h"
+#include "BSP.h"
+#include "UART0.h"
+
+#ifdef OS_TRACE
+
+OS_TraceRing_t OS_Trace;
+
+// ******** OS_TraceInit ************
+// Start UART0 and clear the ring, called by OS_Init
+// Inputs:  none
+// Outputs: none
+void OS_TraceInit(void){
+  UART0_Init();
+  OS_Trace.count = 0;
+  OS_Trace.on = 1;
+}
+
+// ******** outWord ************
+// Send 32 bits, least significant byte first
+static void outWord(uint32_t word){
+  for(int i = 0; i < 4; i++){
+    UART0_OutChar((char)(word&0xFF));
+    word >>= 8;
+  }
+}
+
+// ******** OS_TraceDump ************
+// Send the ring over UART0 at 115200 bps, oldest record first, then
+// clear it and resume tracing. Blocks for about 1 ms per 11 records,
+// so call it from a low-priority thread. Nothing is recorded meanwhile
+//   header: "TRC1", core clock in Hz, records sent, records overwritten
+//   then:   one OS_TraceRecord_t per record
+// All fields are 32-bit little endian
+// Inputs:  none
+// Outputs: none
+void OS_TraceDump(void){
+  long sr = OS_StartCritical();
+  OS_Trace.on = 0;             // freeze the ring, the UART is slow
+  OS_EndCritical(sr);
+  uint32_t count = OS_Trace.count;
+  uint32_t first = 0;
+  if(count > OS_TRACESIZE){    // wrapped, the oldest were overwritten
+    first = count - OS_TRACESIZE;
+  }
+  UART0_OutString("TRC1");
+  outWord(BSP_Clock_GetFreq());
+  outWord(count - first);
+  outWord(first);
+  for(uint32_t i = first; i != count; i++){
+    OS_TraceRecord_t *record = &OS_Trace.buf[i&(OS_TRACESIZE-1)];
+    outWord(record->time);
+    outWord(record->info);
+  }
+  sr = OS_StartCritical();
+  OS_Trace.count = 0;
+  OS_Trace.on = 1;
+  OS_EndCritical(sr);
+}
+
+#ifdef OS_BENCHMARK
+#define BENCHPOINTS 100
+uint32_t TraceCycles;        // cycles per trace point, loop included
+
+// ******** OS_TraceBenchmark ************
+// Time a run of trace points and store the cost of one in
+// TraceCycles. Leaves OS_TRACE_MARK records in the ring
+// Inputs:  none
+// Outputs: none
+void OS_TraceBenchmark(void){
+  uint32_t start = DWT_CYCCNT;
+  for(uint32_t i = 0; i < BENCHPOINTS; i++){
+    OS_TraceMark(0, i);
+  }
+  TraceCycles = (DWT_CYCCNT - start)/BENCHPOINTS;
+}
+#endif
+
+#endif
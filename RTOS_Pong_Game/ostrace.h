@@ -0,0 +1,139 @@
+// ostrace.h
+// Runs on TM4C123
+// Kernel event trace. Context switches, semaphore waits and signals,
+// periodic releases and ISR entry/exit go into a ring of 8-byte
+// records in RAM, each stamped with the DWT cycle counter. When the
+// ring is full the oldest records are overwritten, so it always holds
+// the most recent history. OS_TraceDump sends it over UART0 and
+// tools/trace2json turns the dump into Chrome/Perfetto trace JSON.
+// Everything compiles to nothing unless OS_TRACE is defined
+// (Options for Target->C/C++->Define). Like osbench.h, the trace
+// points need CortexM.h for DWT_CYCCNT.
+
+#ifndef __OSTRACE_H
+#define __OSTRACE_H  1
+
+#include <stdint.h>
+
+// record types, the low byte of info
+#define OS_TRACE_SWITCH   1  // id = thread now running
+#define OS_TRACE_WAIT     2  // id = thread, arg = semaphore
+#define OS_TRACE_SIGNAL   3  // id = thread, arg = semaphore
+#define OS_TRACE_RELEASE  4  // id = periodic event released
+#define OS_TRACE_EVENTRUN 5  // id = periodic event starts running
+#define OS_TRACE_EVENTEND 6  // id = periodic event finished
+#define OS_TRACE_ISRENTER 7  // id = exception number
+#define OS_TRACE_ISREXIT  8  // id = exception number
+#define OS_TRACE_MARK     9  // id and arg chosen by the application
+
+// thread ids for the kernel's own threads, others are the thread number
+#define OS_TRACE_IDLE   0xFF
+#define OS_TRACE_EVENTS 0xFE
+
+#define OS_TRACESIZE 256     // records, a power of two, 8 bytes each
+
+typedef struct{
+  uint32_t time;             // DWT_CYCCNT when it was recorded
+  uint32_t info;             // type | id<<8 | arg<<16
+} OS_TraceRecord_t;
+
+// The ring and its state in one object, so a trace point loads one
+// address from the literal pool instead of three
+typedef struct{
+  uint32_t on;               // 0 while OS_TraceDump reads the ring
+  uint32_t count;            // records ever written, wraps at 2^32
+  OS_TraceRecord_t buf[OS_TRACESIZE];
+} OS_TraceRing_t;
+
+#ifdef OS_TRACE
+
+extern OS_TraceRing_t OS_Trace;
+
+// A trace point masks inline, not with a call to OS_StartCritical,
+// which with the call and return would take half the 20-cycle budget.
+// armcc's __disable_irq returns the old PRIMASK. With OS_BASEPRI it
+// raises BASEPRI to the kernel's ceiling through BASEPRI_MAX, as
+// OS_StartCritical does in osasm.s, so interrupts above
+// OS_KERNELCEILING must not trace. GCC for Cortex-M (the QEMU build)
+// does the same with inline assembly; anything else, such as the
+// host simulation, calls OS_StartCritical. No ISB follows the raise:
+// an interrupt that slips in before it takes effect runs to the end
+// before the record reads the ring, so the record is still whole
+#if defined(__CC_ARM) && defined(OS_BASEPRI)
+  register uint32_t osTraceBasepri_ __asm("basepri");
+  register uint32_t osTraceBasepriMax_ __asm("basepri_max");
+  #define OS_TRACE_LOCK()   uint32_t osTracePm_ = osTraceBasepri_; \
+                            osTraceBasepriMax_ = OS_KERNELCEILING<<5
+  #define OS_TRACE_UNLOCK() osTraceBasepri_ = osTracePm_
+#elif defined(__CC_ARM)
+  #define OS_TRACE_LOCK()   int osTracePm_ = __disable_irq()
+  #define OS_TRACE_UNLOCK() if(!osTracePm_) __enable_irq()
+#elif defined(__GNUC__) && defined(__ARM_ARCH_7EM__) && defined(OS_BASEPRI)
+  #define OS_TRACE_LOCK()   uint32_t osTracePm_; \
+    __asm volatile("mrs %0, basepri\n\tmsr basepri_max, %1" \
+                   : "=&r"(osTracePm_) : "r"(OS_KERNELCEILING<<5) : "memory")
+  #define OS_TRACE_UNLOCK() __asm volatile("msr basepri, %0" : : "r"(osTracePm_) : "memory")
+#elif defined(__GNUC__) && defined(__ARM_ARCH_7EM__)
+  #define OS_TRACE_LOCK()   uint32_t osTracePm_; \
+    __asm volatile("mrs %0, primask\n\tcpsid i" : "=r"(osTracePm_) : : "memory")
+  #define OS_TRACE_UNLOCK() __asm volatile("msr primask, %0" : : "r"(osTracePm_) : "memory")
+#else
+  #define OS_TRACE_LOCK()   long osTracePm_ = OS_StartCritical()
+  #define OS_TRACE_UNLOCK() OS_EndCritical(osTracePm_)
+#endif
+
+// ******** OS_TRACE_POINT ************
+// Record one event, callable from threads and ISRs
+// Inputs:  type, one of OS_TRACE_SWITCH ... OS_TRACE_MARK
+//          id, 0 to 255, usually a thread, event or exception number
+//          arg, 0 to 65535
+#define OS_TRACE_POINT(type, id, arg) do{ \
+  OS_TRACE_LOCK(); \
+  if(OS_Trace.on){ \
+    OS_TraceRecord_t *osTraceRec_ = &OS_Trace.buf[OS_Trace.count++ & (OS_TRACESIZE-1)]; \
+    osTraceRec_->time = DWT_CYCCNT; \
+    osTraceRec_->info = (type) | ((uint32_t)(id)<<8) | ((uint32_t)(arg)<<16); \
+  } \
+  OS_TRACE_UNLOCK(); \
+}while(0)
+
+// ******** OS_TraceInit ************
+// Start UART0 and clear the ring, called by OS_Init
+// Inputs:  none
+// Outputs: none
+void OS_TraceInit(void);
+
+// ******** OS_TraceDump ************
+// Send the ring over UART0 at 115200 bps, oldest record first, then
+// clear it and resume tracing. Blocks for about 1 ms per 11 records,
+// so call it from a low-priority thread. Nothing is recorded meanwhile
+//   header: "TRC1", core clock in Hz, records sent, records overwritten
+//   then:   one OS_TraceRecord_t per record
+// All fields are 32-bit little endian
+// Inputs:  none
+// Outputs: none
+void OS_TraceDump(void);
+
+#ifdef OS_BENCHMARK
+// ******** OS_TraceBenchmark ************
+// Time a run of trace points and store the cost of one in
+// TraceCycles. Leaves OS_TRACE_MARK records in the ring
+// Inputs:  none
+// Outputs: none
+void OS_TraceBenchmark(void);
+#endif
+
+#else
+
+#define OS_TRACE_POINT(type, id, arg)
+
+#endif
+
+// ISR entry and exit, n is the exception number (IRQ number + 16)
+#define OS_TraceIsrEnter(n)   OS_TRACE_POINT(OS_TRACE_ISRENTER, n, 0)
+#define OS_TraceIsrExit(n)    OS_TRACE_POINT(OS_TRACE_ISREXIT, n, 0)
+
+// application marker, shows as an instant event in the trace
+#define OS_TraceMark(id, arg) OS_TRACE_POINT(OS_TRACE_MARK, id, arg)
+
+#endif
@@ -36,6 +36,15 @@
 #define HFAULTSTAT      (*((volatile uint32_t *)0xE000ED2C))
 #define MMADDR          (*((volatile uint32_t *)0xE000ED34))
 #define FAULTADDR       (*((volatile uint32_t *)0xE000ED38))
+#define CPACR           (*((volatile uint32_t *)0xE000ED88))
+#define FPCCR           (*((volatile uint32_t *)0xE000EF34))
+#define MPUCTRL         (*((volatile uint32_t *)0xE000ED94))
+#define MPUNUMBER       (*((volatile uint32_t *)0xE000ED98))
+#define MPUBASE         (*((volatile uint32_t *)0xE000ED9C))
+#define MPUATTR         (*((volatile uint32_t *)0xE000EDA0))
+#define DEMCR           (*((volatile uint32_t *)0xE000EDFC))
+#define DWT_CTRL        (*((volatile uint32_t *)0xE0001000))
+#define DWT_CYCCNT      (*((volatile uint32_t *)0xE0001004))
 
 // these functions are defined in the startup file
 
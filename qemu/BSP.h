@@ -0,0 +1,19 @@
+// BSP.h
+// Runs on QEMU's mps2-an386 (Cortex-M4F), in place of inc/BSP.h
+// The kernel only asks the board for its clock. The mps2 core clock is
+// fixed at 25 MHz, and SysTick and the DWT stand-in both count it.
+
+#ifndef __BSP_H
+#define __BSP_H  1
+
+#include <stdint.h>
+
+// ------------BSP_Clock_InitFastest------------
+// Nothing to do, QEMU's clock is fixed
+void BSP_Clock_InitFastest(void);
+
+// ------------BSP_Clock_GetFreq------------
+// Output: 25,000,000
+uint32_t BSP_Clock_GetFreq(void);
+
+#endif
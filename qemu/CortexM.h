@@ -0,0 +1,46 @@
+// CortexM.h
+// Runs on QEMU's mps2-an386 (Cortex-M4F), in place of inc/CortexM.h
+// QEMU models SysTick, the NVIC, the SCB, the MPU and the FPU at their
+// real addresses, but not the DWT. The DWT registers are routed to
+// platform.c: DWT_CYCCNT reads CMSDK timer 0 counting up at the 25 MHz
+// core clock, and writes to it are ignored, which the kernel tolerates
+// because it only ever uses differences.
+
+#ifndef __CORTEXM_H
+#define __CORTEXM_H  1
+
+#include <stdint.h>
+
+#define STCTRL          (*((volatile uint32_t *)0xE000E010))
+#define STRELOAD        (*((volatile uint32_t *)0xE000E014))
+#define STCURRENT       (*((volatile uint32_t *)0xE000E018))
+#define INTCTRL         (*((volatile uint32_t *)0xE000ED04))
+#define SYSPRI1         (*((volatile uint32_t *)0xE000ED18))
+#define SYSPRI2         (*((volatile uint32_t *)0xE000ED1C))
+#define SYSPRI3         (*((volatile uint32_t *)0xE000ED20))
+#define SYSHNDCTRL      (*((volatile uint32_t *)0xE000ED24))
+#define FAULTSTAT       (*((volatile uint32_t *)0xE000ED28))
+#define HFAULTSTAT      (*((volatile uint32_t *)0xE000ED2C))
+#define MMADDR          (*((volatile uint32_t *)0xE000ED34))
+#define FAULTADDR       (*((volatile uint32_t *)0xE000ED38))
+#define CPACR           (*((volatile uint32_t *)0xE000ED88))
+#define FPCCR           (*((volatile uint32_t *)0xE000EF34))
+#define MPUCTRL         (*((volatile uint32_t *)0xE000ED94))
+#define MPUNUMBER       (*((volatile uint32_t *)0xE000ED98))
+#define MPUBASE         (*((volatile uint32_t *)0xE000ED9C))
+#define MPUATTR         (*((volatile uint32_t *)0xE000EDA0))
+
+extern volatile uint32_t Qemu_Demcr, Qemu_DwtCtrl;
+volatile uint32_t *Qemu_CycCnt(void);
+
+#define DEMCR           Qemu_Demcr
+#define DWT_CTRL        Qemu_DwtCtrl
+#define DWT_CYCCNT      (*Qemu_CycCnt())
+
+void DisableInterrupts(void); // Disable interrupts
+void EnableInterrupts(void);  // Enable interrupts
+long StartCritical(void);     // previous I bit, then disable
+void EndCritical(long sr);    // restore I bit to previous value
+void WaitForInterrupt(void);  // go to low power mode while waiting for the next interrupt
+
+#endif
@@ -0,0 +1,33 @@
+// UART0.h
+// Runs on QEMU's mps2-an386 (Cortex-M4F), in place of inc/UART0.h
+// Output only, on CMSDK UART0, which QEMU's -nographic connects to
+// the terminal. Enough for the benchmark report and OS_TraceDump.
+
+#ifndef __UART0_H
+#define __UART0_H  1
+
+#include <stdint.h>
+
+//------------UART0_Init------------
+// Enable the transmitter
+void UART0_Init(void);
+
+//------------UART0_OutChar------------
+// Output 8-bit to serial port
+// Input: letter is an 8-bit ASCII character to be transferred
+// Output: none
+void UART0_OutChar(char data);
+
+//------------UART0_OutString------------
+// Output String (NULL termination)
+// Input: pointer to a NULL-terminated string to be transferred
+// Output: none
+void UART0_OutString(char *pt);
+
+//-----------------------UART0_OutUDec-----------------------
+// Output a 32-bit number in unsigned decimal format
+// Input: 32-bit number to be transferred
+// Output: none
+void UART0_OutUDec(uint32_t n);
+
+#endif
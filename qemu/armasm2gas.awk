@@ -0,0 +1,67 @@
+# armasm2gas.awk
+# Runs on the host (awk -f armasm2gas.awk ../RTOS_Pong_Game/osasm.s > osasm.S)
+# Translates the armasm subset osasm.s uses into GNU as syntax, so the
+# QEMU build assembles the same context switch as the board. The output
+# goes through cpp: IF :DEF:X becomes #ifdef X.
+# Handled: AREA, THUMB, PRESERVE8, REQUIRE8, EXPORT, IMPORT, EXTERN,
+# IF :DEF:, ELSE, ENDIF, ALIGN, SPACE, END, name EQU value, labels
+# in column 0 and ; comments. Anything else is passed through for gas to judge.
+
+function comment(text){
+  gsub(/\*\//, "* /", text)        # keep the C comment closed
+  return (text == "") ? "" : " /*" text " */"
+}
+
+{
+  sub(/\r$/, "")
+  line = $0
+  note = ""
+  i = index(line, ";")
+  if(i > 0){
+    note = comment(substr(line, i + 1))
+    line = substr(line, 1, i - 1)
+  }
+  label = ""
+  if(match(line, /^[A-Za-z_][A-Za-z0-9_]*/)){
+    label = substr(line, 1, RLENGTH) ":"
+    line = substr(line, RLENGTH + 1)
+  }
+  n = split(line, word, /[ \t,]+/)
+  first = (word[1] == "") ? 2 : 1  # split leaves "" before leading blanks
+  op = word[first]
+  arg = word[first + 1]
+  out = line
+  if(op == "AREA"){
+    if(line ~ /\.bss/) out = "        .bss"
+    else if(line ~ /\.data/) out = "        .data"
+    else out = "        .text"
+    if(match(line, /ALIGN=[0-9]+/)) out = out "\n        .balign " 2^substr(line, RSTART + 6, RLENGTH - 6)
+  } else if(op == "THUMB"){
+    out = "        .syntax unified\n        .thumb"
+  } else if((op == "PRESERVE8") || (op == "REQUIRE8") || (op == "END")){
+    out = ""
+  } else if(op == "EXPORT"){
+    out = "        .global " arg "\n        .type   " arg ", %function"
+  } else if((op == "IMPORT") || (op == "EXTERN")){
+    out = "        .extern " arg
+  } else if((op == "IF") && (arg ~ /^:DEF:/)){
+    out = "#ifdef " substr(arg, 6)
+  } else if(op == "ELSE"){
+    out = "#else"
+  } else if(op == "ENDIF"){
+    out = "#endif"
+  } else if(op == "ALIGN"){
+    out = "        .balign " ((arg == "") ? 4 : arg)
+  } else if(op == "SPACE"){
+    out = "        .space " arg
+  } else if((op == "EQU") && (label != "")){
+    out = "        .equ    " substr(label, 1, length(label) - 1) ", " arg
+    label = ""                     # a symbol, not a label
+  }
+  if((label != "") && (out !~ /^[ \t]*$/)){
+    print label
+  } else if(label != ""){
+    out = label
+  }
+  print out note
+}
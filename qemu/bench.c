@@ -0,0 +1,325 @@
+// bench.c
+// Runs on QEMU's mps2-an386 (make run in qemu/)
+// Micro-benchmarks of the kernel's hot paths, built with GCC from the
+// same os.c and osasm.s that go on the board. QEMU runs with
+// -icount shift=0, so virtual time advances exactly 1 ns per
+// instruction and timer 0 at 25 MHz counts once per 40 instructions.
+// Each benchmark repeats an operation RUNS times and subtracts the
+// same loop with nothing in it, which leaves instructions per operation
+// to within about 40/RUNS.
+// QEMU has no pipeline model, so cycles are an estimate: instructions
+// times BENCH_CPI/100, plus BENCH_EXCCYCLES for each exception entry
+// and return. Calibrate them against OS_BENCHMARK numbers from the
+// board. The FPU row counts PendSV's VPUSH/VPOP but not the S0-S15 and
+// FPSCR the hardware stacks lazily, which execute no instructions;
+// only FpuSwitchBench on the board measures those.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "os.h"
+#include "osring.h"
+#include "ospool.h"
+#include "ostrace.h"
+#include "CortexM.h"
+#include "UART0.h"
+#include "platform.h"
+
+#ifndef BENCH_CPI
+#define BENCH_CPI 130              // cycles per 100 instructions
+#endif
+#ifndef BENCH_EXCCYCLES
+#define BENCH_EXCCYCLES 22         // 12 to stack, 10 to unstack
+#endif
+
+#define RUNS  4000                 // repetitions of each operation
+#define BATCH 8                    // FIFO puts, then gets, below FSIZE
+#define NSPERCOUNT (1000000000/QEMU_CLOCK)
+
+int32_t Ping, Pong;                // OS_Wait/OS_Signal handoff to Echo
+int32_t YieldStart;                // lets Yielder take part
+int32_t FpuStart;                  // lets FpuYielder take part
+int32_t Plain;                     // never has waiters
+Sema_t Counting;                   // the same for OS_SemaWait/Signal
+uint32_t RingBuffer[16];
+OS_Ring_t Ring;                    // OS_RingPut/Get, one side each
+OS_POOL_MEMORY(PoolMemory, 64, 4); // 64-byte frames, as OS_PoolBenchmark
+OS_Pool_t Pool;
+void *Slots[4];
+OS_Mailbox_t Mailbox;
+uint32_t Elements[BATCH];          // through the ring
+volatile uint32_t Yielding;
+volatile uint32_t Sink;
+volatile float FpuSink = 1.0f;
+
+// ******** outTenths ************
+// Print x/10 with one decimal, right aligned in width characters
+static void outTenths(int32_t x, int width){
+  char text[16];
+  int i = sizeof(text) - 1;
+  uint32_t u = (x < 0) ? -x : x;
+  text[i] = 0;
+  text[--i] = (char)('0' + u%10);
+  text[--i] = '.';
+  u = u/10;
+  do{
+    text[--i] = (char)('0' + u%10);
+    u = u/10;
+  }while(u);
+  if(x < 0) text[--i] = '-';
+  while(sizeof(text) - 1 - i < (unsigned)width) text[--i] = ' ';
+  UART0_OutString(&text[i]);
+}
+
+// ******** report ************
+// One line: instructions and estimated cycles per operation
+// Inputs:  name of the operation
+//          timer counts for runs operations, loop already subtracted
+//          cycles each operation spends in exception entry and return
+static void report(char *name, int32_t counts, uint32_t runs, uint32_t hardware){
+  int32_t insns10 = (int32_t)(((int64_t)counts*NSPERCOUNT*10)/(int32_t)runs);
+  int32_t cycles10 = insns10*BENCH_CPI/100 + 10*hardware;
+  UART0_OutString(name);
+  int len = 0;
+  while(name[len]) len++;
+  for(; len < 28; len++) UART0_OutChar(' ');
+  outTenths(insns10, 8);
+  outTenths(cycles10, 12);
+  UART0_OutString("\r\n");
+}
+
+// ******** Echo ************
+// Priority 0: answers every OS_Signal(&Ping) with OS_Signal(&Pong)
+void Echo(void){
+  while(1){
+    OS_Wait(&Ping);
+    OS_Signal(&Pong);
+  }
+}
+
+// ******** Yielder ************
+// Priority 1, with Bench: gives the CPU straight back while Yielding
+void Yielder(void){
+  while(1){
+    OS_Wait(&YieldStart);
+    while(Yielding){
+      OS_Suspend();
+    }
+  }
+}
+
+// ******** FpuYielder ************
+// Priority 1, with Bench: the same, but it has an FPU context, so
+// PendSV saves and restores S0-S31 each time it is switched
+void FpuYielder(void){
+  while(1){
+    OS_Wait(&FpuStart);
+    while(Yielding){
+      FpuSink = FpuSink*1.5f;
+      OS_Suspend();
+    }
+  }
+}
+
+// ******** Bench ************
+// Priority 1: every measurement, then the end of the QEMU run
+void Bench(void){
+  uint32_t start, loop, counts, put, get, i, k;
+  STCTRL = 0;                      // no time slices while measuring
+  UART0_OutString("\r\nkernel micro-benchmarks, mps2-an386 Cortex-M4F, -icount shift=0\r\n");
+  UART0_OutString("operation                      insns  est.cycles\r\n");
+
+  start = Qemu_Count();            // the loop the others are measured in
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+  }
+  loop = Qemu_Count() - start;
+
+  start = Qemu_Count();
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_Signal(&Plain);
+  }
+  report("OS_Signal, no waiter", Qemu_Count() - start - loop, RUNS, 0);
+
+  start = Qemu_Count();
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_Wait(&Plain);
+  }
+  report("OS_Wait, no block", Qemu_Count() - start - loop, RUNS, 0);
+
+  start = Qemu_Count();
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_SemaSignal(&Counting);
+  }
+  report("OS_SemaSignal, no waiter", Qemu_Count() - start - loop, RUNS, 0);
+
+  start = Qemu_Count();
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_SemaWait(&Counting);
+  }
+  report("OS_SemaWait, no block", Qemu_Count() - start - loop, RUNS, 0);
+
+  put = get = 0;                   // batches, the FIFO holds only FSIZE
+  for(i = 0; i < RUNS/BATCH; i++){
+    start = Qemu_Count();
+    for(k = 0; k < BATCH; k++){
+      Sink = k;
+      OS_FIFO_Put(k);
+    }
+    counts = Qemu_Count();
+    put += counts - start;
+    for(k = 0; k < BATCH; k++){
+      Sink = OS_FIFO_Get();
+    }
+    get += Qemu_Count() - counts;
+  }
+  counts = 0;                      // the same batches, empty
+  for(i = 0; i < RUNS/BATCH; i++){
+    start = Qemu_Count();
+    for(k = 0; k < BATCH; k++){
+      Sink = k;
+    }
+    counts += Qemu_Count() - start;
+  }
+  report("OS_FIFO_Put", put - counts, RUNS, 0);
+  report("OS_FIFO_Get, no block", get - counts, RUNS, 0);
+
+  put = get = 0;                   // the ring, one element per call
+  for(i = 0; i < RUNS/BATCH; i++){
+    start = Qemu_Count();
+    for(k = 0; k < BATCH; k++){
+      Sink = k;
+      OS_RingPut(&Ring, &Elements[k], 1);
+    }
+    counts = Qemu_Count();
+    put += counts - start;
+    for(k = 0; k < BATCH; k++){
+      Sink = k;
+      OS_RingGet(&Ring, &Elements[k], 1);
+    }
+    get += Qemu_Count() - counts;
+  }
+  counts = 0;                      // the same batches, empty
+  for(i = 0; i < RUNS/BATCH; i++){
+    start = Qemu_Count();
+    for(k = 0; k < BATCH; k++){
+      Sink = k;
+    }
+    counts += Qemu_Count() - start;
+  }
+  report("OS_RingPut, 1 element", put - counts, RUNS, 0);
+  report("OS_RingGet, 1 element", get - counts, RUNS, 0);
+
+  start = Qemu_Count();            // per element, BATCH per call
+  for(i = 0; i < RUNS/BATCH; i++){
+    Sink = i;
+    OS_RingPut(&Ring, Elements, BATCH);
+    OS_RingGet(&Ring, Elements, BATCH);
+  }
+  counts = Qemu_Count() - start;
+  start = Qemu_Count();
+  for(i = 0; i < RUNS/BATCH; i++){
+    Sink = i;
+  }
+  report("OS_RingPut+Get, batch of 8", counts - (Qemu_Count() - start), RUNS, 0);
+
+  start = Qemu_Count();
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_PoolFree(&Pool, OS_PoolAlloc(&Pool));
+  }
+  report("OS_PoolAlloc+OS_PoolFree", Qemu_Count() - start - loop, RUNS, 0);
+
+  start = Qemu_Count();            // a frame's ownership, not its bytes
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_MailboxPost(&Mailbox, OS_PoolAlloc(&Pool), 0);
+    OS_PoolFree(&Pool, OS_MailboxPend(&Mailbox, 0));
+  }
+  report("pool frame through mailbox", Qemu_Count() - start - loop, RUNS, 0);
+
+  start = Qemu_Count();            // what a trace point would cost as calls
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_EndCritical(OS_StartCritical());
+  }
+  report("OS_StartCritical+EndCritical", Qemu_Count() - start - loop, RUNS, 0);
+
+#ifdef OS_TRACE
+  start = Qemu_Count();            // inline mask, the 20-cycle budget
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_TraceMark(0, i);
+  }
+  report("OS_TraceMark", Qemu_Count() - start - loop, RUNS, 0);
+#endif
+
+  start = Qemu_Count();            // SysTick pended by hand, no switch
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    INTCTRL = 0x04000000;          // PENDSTSET, taken at once
+  }
+  report("SysTick_Handler", Qemu_Count() - start - loop, RUNS, BENCH_EXCCYCLES);
+
+  start = Qemu_Count();            // two switches and both threads' calls
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_Signal(&Ping);              // Echo preempts here
+    OS_Wait(&Pong);                // already signaled
+  }
+  report("OS_Signal/OS_Wait handoff", Qemu_Count() - start - loop, RUNS, 2*BENCH_EXCCYCLES);
+
+  Yielding = 1;
+  OS_Signal(&YieldStart);
+  OS_Suspend();                    // Yielder now waits in OS_Suspend
+  start = Qemu_Count();            // two switches and both OS_Suspends
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_Suspend();
+  }
+  report("OS_Suspend round robin", Qemu_Count() - start - loop, RUNS, 2*BENCH_EXCCYCLES);
+  Yielding = 0;
+  OS_Suspend();
+
+  Yielding = 1;                    // the same with one thread using the FPU
+  OS_Signal(&FpuStart);
+  OS_Suspend();
+  start = Qemu_Count();
+  for(i = 0; i < RUNS; i++){
+    Sink = i;
+    OS_Suspend();
+  }
+  report("OS_Suspend round robin, FPU", Qemu_Count() - start - loop, RUNS,
+         2*BENCH_EXCCYCLES);       // lazy stacking not included
+  Yielding = 0;
+  OS_Suspend();
+
+  UART0_OutString("cycles = insns*");
+  UART0_OutUDec(BENCH_CPI);
+  UART0_OutString("/100 + ");
+  UART0_OutUDec(BENCH_EXCCYCLES);
+  UART0_OutString(" per exception, FPU lazy stacking not included\r\n");
+  Qemu_Exit();
+}
+
+int main(void){
+  OS_Init();
+  UART0_Init();
+  OS_InitSemaphore(&Ping, 0);
+  OS_InitSemaphore(&Pong, 0);
+  OS_InitSemaphore(&YieldStart, 0);
+  OS_InitSemaphore(&FpuStart, 0);
+  OS_InitSemaphore(&Plain, 0);
+  OS_SemaInit(&Counting, 0, OS_ORDER_FIFO);
+  OS_FIFO_Init();
+  OS_RingInit(&Ring, RingBuffer, 16, sizeof(uint32_t));
+  OS_PoolInit(&Pool, PoolMemory, 64, 4);
+  OS_MailboxInit(&Mailbox, Slots, 4);
+  OS_AddThreads(&Echo, 0, &Yielder, 1, &Bench, 1,
+                &FpuYielder, 1, NULL, 0, NULL, 0);
+  OS_Launch(QEMU_CLOCK/1000);      // 1 ms, until Bench stops SysTick
+  return 0;                        // never reached
+}
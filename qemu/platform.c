@@ -0,0 +1,80 @@
+// platform.c
+// Runs on QEMU's mps2-an386 (Cortex-M4F)
+// Board shim for the kernel under QEMU: the clock BSP.h reports,
+// CMSDK timer 0 as the DWT cycle counter, CMSDK UART0 for output and
+// semihosting to end the run.
+
+#include <stdint.h>
+#include "BSP.h"
+#include "CortexM.h"
+#include "UART0.h"
+#include "platform.h"
+
+#define TIMER0_CTRL     (*((volatile uint32_t *)0x40000000))
+#define TIMER0_VALUE    (*((volatile uint32_t *)0x40000004))
+#define TIMER0_RELOAD   (*((volatile uint32_t *)0x40000008))
+
+#define UART0_DATA      (*((volatile uint32_t *)0x40004000))
+#define UART0_STATE     (*((volatile uint32_t *)0x40004004))
+#define UART0_CTRL      (*((volatile uint32_t *)0x40004008))
+#define UART0_BAUDDIV   (*((volatile uint32_t *)0x40004010))
+
+volatile uint32_t Qemu_Demcr, Qemu_DwtCtrl;  // DEMCR and DWT_CTRL, unused
+static volatile uint32_t CycCnt;             // last DWT_CYCCNT read
+
+void BSP_Clock_InitFastest(void){
+}
+
+uint32_t BSP_Clock_GetFreq(void){
+  return QEMU_CLOCK;
+}
+
+uint32_t Qemu_Count(void){
+  if(!(TIMER0_CTRL & 1)){          // first call, start it free running
+    TIMER0_RELOAD = 0xFFFFFFFF;
+    TIMER0_VALUE = 0xFFFFFFFF;
+    TIMER0_CTRL = 1;
+  }
+  return 0xFFFFFFFF - TIMER0_VALUE;
+}
+
+// ******** Qemu_CycCnt ************
+// DWT_CYCCNT in CortexM.h: refresh the copy, hand back its address,
+// so a read sees the timer and a write changes only the copy
+volatile uint32_t *Qemu_CycCnt(void){
+  CycCnt = Qemu_Count();
+  return &CycCnt;
+}
+
+void Qemu_Exit(void){
+  register uint32_t reason __asm("r0") = 0x18;       // SYS_EXIT
+  register uint32_t code __asm("r1") = 0x20026;      // ADP_Stopped_ApplicationExit
+  while(1){
+    __asm volatile("bkpt 0xAB" : : "r"(reason), "r"(code) : "memory");
+  }
+}
+
+void UART0_Init(void){
+  UART0_BAUDDIV = 16;              // the smallest divider, QEMU ignores it
+  UART0_CTRL = 0x01;               // TX enable
+}
+
+void UART0_OutChar(char data){
+  while(UART0_STATE & 0x01){}      // TX buffer full
+  UART0_DATA = (uint8_t)data;
+}
+
+void UART0_OutString(char *pt){
+  while(*pt){
+    UART0_OutChar(*pt);
+    pt++;
+  }
+}
+
+void UART0_OutUDec(uint32_t n){
+  if(n >= 10){
+    UART0_OutUDec(n/10);
+    n = n%10;
+  }
+  UART0_OutChar((char)(n + '0'));
+}
@@ -0,0 +1,24 @@
+// platform.h
+// Runs on QEMU's mps2-an386 (Cortex-M4F)
+// What the benchmarks need from the emulated board beyond the BSP.
+
+#ifndef __PLATFORM_H
+#define __PLATFORM_H  1
+
+#include <stdint.h>
+
+#define QEMU_CLOCK 25000000        // core, SysTick and timer 0, Hz
+
+// ******** Qemu_Count ************
+// CMSDK timer 0 counting up at QEMU_CLOCK, wraps after 171 s
+// Inputs:  none
+// Outputs: counts since the first call
+uint32_t Qemu_Count(void);
+
+// ******** Qemu_Exit ************
+// End the QEMU session through semihosting (-semihosting)
+// Inputs:  none
+// Outputs: does not return
+void Qemu_Exit(void);
+
+#endif
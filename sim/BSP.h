@@ -0,0 +1,59 @@
+// BSP.h
+// Runs on the host, in place of inc/BSP.h
+// The part of the MKII BoosterPack interface the kernel and the game
+// use, with the same prototypes. simbsp.c implements it: the LCD only
+// costs simulated time, the joystick and buttons follow the seed.
+
+#ifndef __BSP_H
+#define __BSP_H  1
+
+#include <stdint.h>
+
+#define LCD_BLACK      0x0000   //   0,   0,   0
+#define LCD_BLUE       0x001F   //   0,   0, 255
+#define LCD_RED        0xF800   // 255,   0,   0
+#define LCD_GREEN      0x07E0   //   0, 255,   0
+#define LCD_YELLOW     0xFFE0   // 255, 255,   0
+#define LCD_WHITE      0xFFFF   // 255, 255, 255
+
+// ------------BSP_Joystick_Init------------
+// Nothing to set up on the host
+void BSP_Joystick_Init(void);
+
+// ------------BSP_Joystick_Input------------
+// Read a seeded random walk around the rest position
+// Input: x, y: 10-bit positions, 512 at rest
+//        select: 0 if pressed, 1 if not
+// Output: none
+void BSP_Joystick_Input(uint16_t *x, uint16_t *y, uint8_t *select);
+
+// ------------BSP_LCD_Init------------
+// Charges the time the real ST7735 start-up takes
+void BSP_LCD_Init(void);
+
+// ------------BSP_LCD_DrawFastVLine------------
+// Charges the SPI time for h pixels
+void BSP_LCD_DrawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color);
+
+// ------------BSP_LCD_FillScreen------------
+// Charges the SPI time for the whole 128x128 screen
+void BSP_LCD_FillScreen(uint16_t color);
+
+// ------------BSP_LCD_FillRect------------
+// Charges the SPI time for w*h pixels
+void BSP_LCD_FillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color);
+
+// ------------BSP_LCD_DrawString------------
+// Charges the SPI time for 6x8 pixels per character
+// Output: number of characters
+uint32_t BSP_LCD_DrawString(uint16_t x, uint16_t y, char *pt, int16_t textColor);
+
+// ------------BSP_Clock_InitFastest------------
+// The simulated core always runs at 80 MHz
+void BSP_Clock_InitFastest(void);
+
+// ------------BSP_Clock_GetFreq------------
+// Output: 80,000,000
+uint32_t BSP_Clock_GetFreq(void);
+
+#endif
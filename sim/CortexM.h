@@ -0,0 +1,57 @@
+// CortexM.h
+// Runs on the host, in place of inc/CortexM.h
+// The core registers the kernel touches are plain variables owned by
+// simport.c, which gives them the hardware's behavior at the points
+// where the kernel hands control back: the interrupt mask functions
+// below, OS_StartCritical and OS_EndCritical, and WaitForInterrupt.
+// Register names match inc/CortexM.h so os.c compiles unchanged.
+
+#ifndef __CORTEXM_H
+#define __CORTEXM_H  1
+
+#include <stdint.h>
+
+#define SIM_STCTRL      0
+#define SIM_STRELOAD    1
+#define SIM_STCURRENT   2
+#define SIM_INTCTRL     3
+#define SIM_SYSPRI3     4
+#define SIM_SYSHNDCTRL  5
+#define SIM_FAULTSTAT   6
+#define SIM_MMADDR      7
+#define SIM_FPCCR       8
+#define SIM_MPUCTRL     9
+#define SIM_MPUNUMBER   10
+#define SIM_MPUBASE     11
+#define SIM_MPUATTR     12
+#define SIM_DEMCR       13
+#define SIM_DWT_CTRL    14
+#define SIM_DWT_CYCCNT  15
+#define SIM_REGS        16
+
+extern volatile uint32_t SimReg[SIM_REGS];
+
+#define STCTRL          SimReg[SIM_STCTRL]
+#define STRELOAD        SimReg[SIM_STRELOAD]
+#define STCURRENT       SimReg[SIM_STCURRENT]
+#define INTCTRL         SimReg[SIM_INTCTRL]
+#define SYSPRI3         SimReg[SIM_SYSPRI3]
+#define SYSHNDCTRL      SimReg[SIM_SYSHNDCTRL]
+#define FAULTSTAT       SimReg[SIM_FAULTSTAT]
+#define MMADDR          SimReg[SIM_MMADDR]
+#define FPCCR           SimReg[SIM_FPCCR]
+#define MPUCTRL         SimReg[SIM_MPUCTRL]
+#define MPUNUMBER       SimReg[SIM_MPUNUMBER]
+#define MPUBASE         SimReg[SIM_MPUBASE]
+#define MPUATTR         SimReg[SIM_MPUATTR]
+#define DEMCR           SimReg[SIM_DEMCR]
+#define DWT_CTRL        SimReg[SIM_DWT_CTRL]
+#define DWT_CYCCNT      SimReg[SIM_DWT_CYCCNT]
+
+void DisableInterrupts(void); // Disable interrupts
+void EnableInterrupts(void);  // Enable interrupts
+long StartCritical(void);     // previous I bit, then disable
+void EndCritical(long sr);    // restore I bit to previous value
+void WaitForInterrupt(void);  // skip simulated time to the next interrupt
+
+#endif
@@ -0,0 +1,28 @@
+// UART0.h
+// Runs on the host, in place of inc/UART0.h
+// The output half of UART0 at 115200 bps, which ostrace.c uses for
+// OS_TraceDump. Characters go to the file named by SIM_UART, and each
+// one costs the 87 usec the real UART takes to send it.
+
+#ifndef __UART0_H
+#define __UART0_H  1
+
+#include <stdint.h>
+
+//------------UART0_Init------------
+// Open the SIM_UART file, if one is set
+void UART0_Init(void);
+
+//------------UART0_OutChar------------
+// Output 8-bit to serial port
+// Input: letter is an 8-bit ASCII character to be transferred
+// Output: none
+void UART0_OutChar(char data);
+
+//------------UART0_OutString------------
+// Output String (NULL termination)
+// Input: pointer to a NULL-terminated string to be transferred
+// Output: none
+void UART0_OutString(char *pt);
+
+#endif
@@ -0,0 +1,132 @@
+// edfsim.c
+// Runs on the host (make edfsim in sim/, then ./edfsim), always
+// built with OS_EDF
+// EDF threads on the simulated Cortex-M, admitted up to the limit:
+//   Steady A   period 10, deadline 10, budget 3, runs 1 to 1.9 ticks
+//   Steady B   period 10, deadline 10, budget 3, the same
+//   Greedy     period 10, deadline 10, budget 2, never ends a job
+//   Sleepy     period 20, deadline 20, budget 2, every 5th job sleeps
+//              past its deadline without using its budget
+// That is 90% of the CPU, so a thread asking for another 40% must be
+// refused, as must one whose budget exceeds its deadline. The report
+// fails the run unless:
+//   both refusals happened and the four threads were admitted
+//   the Steady threads never missed, though Greedy overran every job
+//   every Greedy release was an overrun and a miss
+//   Sleepy missed once per sleeping job, with no overrun
+//   Background, a fixed-priority thread, kept its 10% of the CPU
+
+#include <stdint.h>
+#include <stdio.h>
+#include "os.h"
+#include "CortexM.h"
+#include "simport.h"
+
+#define TIMESLICE 80000            // 1 ms ticks
+
+enum { STEADYA, STEADYB, GREEDY, SLEEPY, THREADS };
+static const char *Name[THREADS] = {"steady A", "steady B", "greedy", "sleepy"};
+uint32_t Jobs[THREADS];
+uint32_t Sleeps;                   // Sleepy jobs that slept
+uint32_t Admitted, Refused;
+uint64_t BackgroundCycles;
+
+// ******** Steady ************
+// Well within its budget, must never miss
+void Steady(void *arg){
+  uint32_t id = (uint32_t)arg;
+  for(;;){
+    Sim_Work(Sim_Range(80000, 150000));
+    Jobs[id]++;
+    OS_EdfWaitNext();
+  }
+}
+
+// ******** Greedy ************
+// Never calls OS_EdfWaitNext; SysTick stops each job at its budget
+void Greedy(void *arg){
+  for(;;){
+    Sim_Work(TIMESLICE/10);
+  }
+}
+
+// ******** Sleepy ************
+// Every 5th job sleeps past its deadline, its CPU time is tiny
+void Sleepy(void *arg){
+  for(;;){
+    Sim_Work(10000);
+    if((Jobs[SLEEPY]%5) == 4){
+      Sleeps++;
+      OS_Sleep(25);
+    }
+    Jobs[SLEEPY]++;
+    OS_EdfWaitNext();
+  }
+}
+
+// ******** Background ************
+// Priority 3: runs in whatever EDF leaves
+void Background(void *arg){
+  for(;;){
+    Sim_Work(1000);
+    BackgroundCycles += 1000;
+  }
+}
+
+// ******** Report ************
+// At the end of the simulated time
+int Report(void){
+  uint32_t failed = 0;
+  uint32_t misses[THREADS], overruns[THREADS];
+  printf("admission  %u admitted, %u refused  %s\n", Admitted, Refused,
+         ((Admitted == THREADS) && (Refused == 2)) ? "ok" : "FAIL");
+  failed |= !((Admitted == THREADS) && (Refused == 2));
+  for(uint32_t i = 0; i < THREADS; i++){
+    misses[i] = overruns[i] = 0;
+    OS_EdfStats(i, &misses[i], &overruns[i]);
+  }
+  Jobs[GREEDY] = (uint32_t)(Sim_Now()/(10*TIMESLICE));  // releases so far
+  for(uint32_t i = 0; i < THREADS; i++){
+    uint32_t ok;
+    if(i == GREEDY){               // the job running at the end may not have overrun yet
+      ok = (overruns[i] == misses[i]) && (overruns[i] + 1 >= Jobs[i]) && (Jobs[i] > 0);
+    } else if(i == SLEEPY){        // the last sleep may still be going on
+      ok = (overruns[i] == 0) && (misses[i] <= Sleeps) && (misses[i] + 1 >= Sleeps)
+           && (Sleeps > 0);
+    } else{
+      ok = (misses[i] == 0) && (overruns[i] == 0) && (Jobs[i] > 0);
+    }
+    printf("%-10s %4u jobs, %4u misses, %4u overruns  %s\n", Name[i],
+           Jobs[i], misses[i], overruns[i], ok ? "ok" : "FAIL");
+    failed |= !ok;
+  }
+  double share = 100.0*BackgroundCycles/Sim_Now();
+  printf("background %.1f%% of the CPU  %s\n", share, (share >= 9.0) ? "ok" : "FAIL");
+  failed |= (share < 9.0);
+  return failed ? 1 : 0;
+}
+
+// ******** admit ************
+// Create an EDF thread and count the outcome
+static void admit(void(*task)(void *), uint32_t id,
+                  uint32_t period, uint32_t deadline, uint32_t budget){
+  if(OS_CreateEdfThread(task, (void *)id, NULL, 256, period, deadline, budget)){
+    Admitted++;
+  } else{
+    Refused++;
+  }
+}
+
+int main(void){
+  OS_Init();
+  admit(&Steady, STEADYA, 10, 10, 3);   // 30%
+  admit(&Steady, STEADYB, 10, 10, 3);   // 60%
+  admit(&Steady, THREADS, 10, 10, 4);   // 100%, refused
+  admit(&Greedy, GREEDY, 10, 10, 2);    // 80%
+  admit(&Steady, THREADS, 10, 5, 6);    // budget over deadline, refused
+  admit(&Sleepy, SLEEPY, 20, 20, 2);    // 90%
+  OS_CreateThread(&Background, NULL, NULL, 256, 3);
+  Sim_OnEnd(&Report);
+  OS_Launch(TIMESLICE);
+  return 0;                        // never reached
+}
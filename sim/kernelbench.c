@@ -0,0 +1,190 @@
+// kernelbench.c
+// Runs on the host (make kernelbench in sim/, then ./kernelbench)
+// How kernel paths scale with the number of threads, timed in host
+// nanoseconds around the unchanged os.c. Simulated time stands still
+// while it runs, so no SysTick or device interrupt lands inside a
+// measurement. Each row is the best of BATCHES runs of CALLS calls.
+// The old round-robin walk is copied from the original os.c, so the
+// two columns compare the same compiler and host.
+// Host nanoseconds are not Cortex-M4 cycles; what carries over to the
+// board is how each column grows with the thread count.
+//   scheduler  Scheduler() with all but one thread blocked, against
+//              the do/while walk over RunPt->next it replaced
+//   systick    SysTick_Handler() with every other thread asleep, against
+//              the old tick: decrement every TCB's sleep, then the walk
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "os.h"
+#include "CortexM.h"
+#include "simport.h"
+
+#define TIMESLICE 80000            // 1 ms ticks
+#define CALLS     200000
+#define BATCHES   7
+#define FOREVER   0xFFFFFFFF       // ticks, far beyond any run
+
+void Scheduler(void);
+void SysTick_Handler(void);
+
+Sema_t Park;                       // parked threads wait here
+
+// ******** nowNs ************
+static uint64_t nowNs(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+// The original TCB and walk, enough of them to time the walk alone
+typedef struct oldtcb{
+  int32_t *sp;
+  struct oldtcb *next;
+  int32_t *blocked;
+  uint32_t sleep;
+} oldtcb_t;
+oldtcb_t OldTcbs[NUMTHREADS];
+oldtcb_t *OldRunPt;
+int32_t OldSema;
+
+// ******** oldWalk ************
+// The thread selection of the original Scheduler()
+static void __attribute__((noinline)) oldWalk(void){
+  do {
+    OldRunPt = OldRunPt->next;
+  } while( (OldRunPt->blocked != 0) || (OldRunPt->sleep > 0) );
+}
+
+// ******** oldTick ************
+// What the original SysTick did between saving and restoring R4-R11:
+// Scheduler() called runperiodicevents(), which visited every TCB,
+// then walked to the next ready thread. No periodic event is due
+static uint32_t OldThreads;
+static uint32_t OldCounter[2];     // NUMPERIODIC, all idle
+static void __attribute__((noinline)) oldTick(void){
+  oldtcb_t *temp = OldRunPt;
+  for(uint32_t i = 0; i < OldThreads; i++){
+    if(temp->sleep > 0){
+      temp->sleep--;
+    }
+    temp = temp->next;
+  }
+  for(int i = 0; i < 2; i++){
+    if(OldCounter[i] > 0){
+      OldCounter[i]--;
+    }
+  }
+  oldWalk();
+}
+
+// ******** oldRing ************
+// n TCBs in a ring, as OS_AddThreads linked them, all but the first
+// blocked, or asleep if sleeping
+static void oldRing(uint32_t n, int sleeping){
+  for(uint32_t i = 0; i < n; i++){
+    OldTcbs[i].next = &OldTcbs[(i + 1)%n];
+    OldTcbs[i].blocked = ((i == 0) || sleeping) ? 0 : &OldSema;
+    OldTcbs[i].sleep = ((i == 0) || !sleeping) ? 0 : FOREVER;
+  }
+  OldRunPt = &OldTcbs[0];
+  OldThreads = n;
+}
+
+// ******** best ************
+// Fewest nanoseconds per call of fn over BATCHES batches
+static double best(void(*fn)(void)){
+  double fewest = 1e30;
+  for(int b = 0; b < BATCHES; b++){
+    uint64_t start = nowNs();
+    for(uint32_t i = 0; i < CALLS; i++){
+      fn();
+    }
+    double ns = (double)(nowNs() - start)/CALLS;
+    if(ns < fewest){
+      fewest = ns;
+    }
+  }
+  return fewest;
+}
+
+// ******** Parked ************
+// Blocks until Bench signals Park, then sleeps for good
+void Parked(void *arg){
+  OS_SemaWait(&Park);
+  for(;;){
+    OS_Sleep(FOREVER);
+  }
+}
+
+// ******** park ************
+// Create threads at priority 1, above Bench, until total threads
+// exist; each runs at once and blocks
+static uint32_t Threads = 1;       // Bench
+static void park(uint32_t total){
+  while(Threads < total){
+    if(OS_CreateThread(&Parked, NULL, NULL, 256, 1) == 0){
+      printf("could not create thread %u\n", Threads);
+      exit(1);
+    }
+    Threads++;
+  }
+}
+
+// ******** nap ************
+// Release parked threads into OS_Sleep until count are asleep; each
+// runs as soon as it is signaled
+static uint32_t Sleeping;
+static void nap(uint32_t count){
+  park(count + 1);
+  while(Sleeping < count){
+    OS_SemaSignal(&Park);
+    Sleeping++;
+  }
+}
+
+// ******** newScheduler ************
+// One Scheduler() as PendSV calls it, Bench is the only ready thread
+static void newScheduler(void){
+  long sr = OS_StartCritical();
+  Scheduler();
+  OS_EndCritical(sr);
+}
+
+// ******** Bench ************
+// Priority 3: every table, then the end of the run
+void Bench(void *arg){
+  static const uint32_t threads[] = {6, 16, 32};
+  static const uint32_t sleepers[] = {6, 16, 32, 64};
+  printf("scheduler, all threads but one blocked, host ns per call\n");
+  printf("threads   bitmap   linear walk\n");
+  for(uint32_t k = 0; k < sizeof(threads)/sizeof(threads[0]); k++){
+    uint32_t n = threads[k];
+    park(n);
+    oldRing(n, 0);
+    double bitmap = best(&newScheduler);
+    double walk = best(&oldWalk);
+    printf("%7u %8.1f %13.1f\n", n, bitmap, walk);
+  }
+  printf("\nsystick, one thread ready and the rest asleep, host ns per tick\n");
+  printf("sleepers   sleep list   decrement all\n");
+  for(uint32_t k = 0; k < sizeof(sleepers)/sizeof(sleepers[0]); k++){
+    uint32_t n = sleepers[k];
+    nap(n);
+    oldRing(n + 1, 1);
+    double list = best(&SysTick_Handler);
+    double all = best(&oldTick);
+    printf("%8u %12.1f %15.1f\n", n, list, all);
+  }
+  exit(0);                         // simulated time never moved
+}
+
+int main(void){
+  OS_Init();
+  OS_SemaInit(&Park, 0, OS_ORDER_FIFO);
+  OS_CreateThread(&Bench, NULL, NULL, 256, 3);
+  OS_Launch(TIMESLICE);
+  return 0;                        // never reached
+}
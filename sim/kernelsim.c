@@ -0,0 +1,208 @@
+// kernelsim.c
+// Runs on the host (make in sim/, then ./kernelsim)
+// A seeded workload for os.c on the simulated Cortex-M: a periodic
+// event feeds the FIFO and releases a handler thread, a virtual device
+// IRQ signals another, and threads sleep, ping-pong on semaphores and
+// burn CPU at five priorities. A second device at priority 0 makes no
+// kernel calls; its latency shows what the kernel's critical sections
+// hold off, nothing with OS_BASEPRI. The thread functions check the kernel
+// as they go and the report at the end fails the run if:
+//   the FIFO delivers data out of order
+//   OS_Sleep returns before its ticks have passed
+//   a semaphore handoff is lost
+// The last line is the switch digest; the same SIM_SEED must give
+// the same digest on every run.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "os.h"
+#include "CortexM.h"
+#include "simport.h"
+
+#define TIMESLICE 80000            // 1 ms ticks
+
+Sema_t TickSema, IsrSema, PingSema, PongSema;
+
+uint32_t Seq;                      // next value the event puts
+uint32_t Received, Lost, OutOfOrder;
+uint32_t Sleeps, EarlyWakes;
+uint32_t HandlerRuns, IsrSignals, IsrRuns;
+uint32_t Pings, Pongs;
+uint32_t HogChunks;
+uint64_t TickRelease;              // cycle the last tick event ran
+uint64_t MaxLatency;               // cycles from TickRelease to Handler
+uint32_t UrgentRuns;
+
+// Interrupt latency of one device, in cycles
+typedef struct{
+  uint32_t count;
+  uint32_t max;
+  uint64_t sum;
+} latency_t;
+latency_t DeviceLatency, UrgentLatency;
+
+// ******** Sample ************
+// Record the running device's latency, first thing in its handler
+void Sample(latency_t *latency){
+  uint32_t cycles = Sim_Latency();
+  latency->count++;
+  latency->sum += cycles;
+  if(cycles > latency->max){
+    latency->max = cycles;
+  }
+}
+
+// ******** Producer ************
+// 1 ms periodic event: next FIFO value, then release Handler
+void Producer(void){
+  Sim_Work(Sim_Range(100, 600));
+  if(OS_FIFO_Put(Seq) == 0){
+    Seq++;
+  } else{
+    Lost++;
+  }
+  TickRelease = Sim_Now();
+  OS_SemaSignal(&TickSema);
+}
+
+// ******** DeviceIsr ************
+// The virtual device, about every 2.9 ms
+void DeviceIsr(void){
+  Sample(&DeviceLatency);
+  Sim_Work(Sim_Range(50, 200));
+  IsrSignals++;
+  OS_SemaSignal(&IsrSema);
+}
+
+// ******** UrgentIsr ************
+// Priority 0, about every 37 us, above OS_KERNELCEILING: no OS_ calls
+void UrgentIsr(void){
+  Sample(&UrgentLatency);
+  Sim_Work(Sim_Range(20, 80));
+  UrgentRuns++;
+}
+
+void Handler(void){                // priority 0
+  while(1){
+    OS_SemaWait(&TickSema);
+    uint64_t latency = Sim_Now() - TickRelease;
+    if(latency > MaxLatency){
+      MaxLatency = latency;
+    }
+    HandlerRuns++;
+    Sim_Work(Sim_Range(200, 2000));
+  }
+}
+
+void Consumer(void){               // priority 1
+  uint32_t expected = 0;
+  while(1){
+    uint32_t data = OS_FIFO_Get();
+    if(data != expected){
+      OutOfOrder++;
+    }
+    expected = data + 1;
+    Received++;
+    Sim_Work(Sim_Range(500, 4000));
+  }
+}
+
+void IsrWaiter(void){              // priority 1
+  while(1){
+    OS_SemaWait(&IsrSema);
+    IsrRuns++;
+    Sim_Work(Sim_Range(100, 1000));
+  }
+}
+
+void Sleeper(void){                // priority 2
+  while(1){
+    uint32_t ticks = Sim_Range(1, 40);
+    uint64_t start = OS_TickCount();
+    OS_Sleep(ticks);
+    if(OS_TickCount() - start < ticks){
+      EarlyWakes++;
+    }
+    Sleeps++;
+    Sim_Work(Sim_Range(100, 3000));
+  }
+}
+
+void Ping(void){                   // priority 3
+  while(1){
+    Sim_Work(Sim_Range(1000, 20000));
+    Pings++;
+    OS_SemaSignal(&PingSema);
+    OS_SemaWait(&PongSema);
+    OS_Sleep(Sim_Range(0, 3));
+  }
+}
+
+void Pong(void){                   // priority 3
+  while(1){
+    OS_SemaWait(&PingSema);
+    Pongs++;
+    Sim_Work(Sim_Range(1000, 20000));
+    OS_SemaSignal(&PongSema);
+  }
+}
+
+void Hog(void){                    // priority 5, takes what is left
+  while(1){
+    Sim_Work(Sim_Range(1000, 50000));
+    HogChunks++;
+    if(Sim_Range(0, 63) == 0){
+      OS_Sleep(Sim_Range(10, 60));   // lets the idle thread sleep tickless
+    }
+  }
+}
+
+// ******** Report ************
+// Runs when SIM_MS is up, returns the exit status
+int Report(void){
+  int fail = 0;
+  double ms = Sim_Now()/80000.0;
+  printf("seed %u, %.3f ms, %u context switches, %.1f%% idle\n", Sim_Seed(), ms,
+         Sim_Switches(), 100.0*Sim_IdleCycles()/Sim_Now());
+  printf("fifo     %u received, %u lost, %u out of order\n", Received, Lost, OutOfOrder);
+  printf("sleep    %u sleeps, %u woke early\n", Sleeps, EarlyWakes);
+  printf("handler  %u runs, latency up to %.1f us\n", HandlerRuns, MaxLatency/80.0);
+  printf("device   %u signals, %u runs\n", IsrSignals, IsrRuns);
+  printf("irq      priority 5 latency up to %.2f us, mean %.3f us\n", DeviceLatency.max/80.0,
+         DeviceLatency.count ? DeviceLatency.sum/80.0/DeviceLatency.count : 0.0);
+  printf("irq      priority 0 latency up to %.2f us, mean %.3f us, %u runs\n", UrgentLatency.max/80.0,
+         UrgentLatency.count ? UrgentLatency.sum/80.0/UrgentLatency.count : 0.0, UrgentRuns);
+  OS_PeriodicStats_t producer;
+  OS_PeriodicStats(0, &producer);
+  printf("producer %u runs, release jitter %.2f us, runs up to %.2f us\n", producer.runs,
+         (producer.maxLate - producer.minLate)/80.0, producer.maxExec/80.0);
+  printf("masked   I bit up to %.2f us, BASEPRI up to %.2f us\n", Sim_PrimaskMax()/80.0,
+         Sim_BasepriMax()/80.0);
+  printf("pingpong %u pings, %u pongs\n", Pings, Pongs);
+  printf("hog      %u chunks\n", HogChunks);
+  if(OutOfOrder || EarlyWakes || (Pings - Pongs > 1) || (IsrSignals - IsrRuns > 1)){
+    printf("FAIL\n");
+    fail = 1;
+  }
+  printf("digest   %016llx\n", (unsigned long long)Sim_Digest());
+  return fail;
+}
+
+int main(void){
+  OS_Init();
+  OS_SemaInit(&TickSema, 0, OS_ORDER_FIFO);
+  OS_SemaInit(&IsrSema, 0, OS_ORDER_FIFO);
+  OS_SemaInit(&PingSema, 0, OS_ORDER_FIFO);
+  OS_SemaInit(&PongSema, 0, OS_ORDER_FIFO);
+  OS_FIFO_Init();
+  OS_AddThreads(&Handler, 0, &Consumer, 1, &IsrWaiter, 1,
+                &Sleeper, 2, &Ping, 3, &Pong, 3);
+  OS_CreateThread((void(*)(void *))&Hog, NULL, NULL, 512, 5);
+  OS_AddPeriodicEventThread(&Producer, 1);
+  Sim_AddInterrupt(&DeviceIsr, 232000, 80000);
+  Sim_AddInterrupt(&UrgentIsr, 2960, 1000);
+  Sim_InterruptPriority(&UrgentIsr, 0);
+  Sim_OnEnd(&Report);
+  OS_Launch(TIMESLICE);
+  return 0;                        // never reached
+}
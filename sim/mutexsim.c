@@ -0,0 +1,177 @@
+// mutexsim.c
+// Runs on the host (make mutexsim in sim/, then ./mutexsim)
+// Priority inheritance on the simulated Cortex-M, two scenarios:
+//   inversion  the README's: Renderer at priority 5 draws under
+//              LCDMutex, Input at priority 1 locks it when its device
+//              interrupts, and Hog at priority 3 burns CPU in bursts
+//              released by another device. Input must never wait
+//              longer than one Renderer critical section, however
+//              much Hog wants to run
+//   chain      Owner holds a mutex and waits on a priority semaphore
+//              behind a higher priority thread. When Boss waits for
+//              the mutex, Owner must move up the semaphore's queue,
+//              so the next signal wakes Owner and Boss gets its mutex
+// Exits with status 1 if either check fails.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "os.h"
+#include "CortexM.h"
+#include "simport.h"
+
+#define TIMESLICE 80000            // 1 ms ticks
+#define CSMIN     2000             // Renderer's critical section, cycles
+#define CSMAX     6000
+
+OS_Mutex_t LCDMutex, ChainMutex;
+Sema_t InputSema, HogSema, ChainSema;
+
+uint32_t Draws, Inputs, Inversions, HogBusy, Bursts;
+uint64_t MaxWait;                  // cycles Input spent in OS_MutexLock
+
+char ChainOrder[4];                // who got past ChainSema first
+uint32_t ChainWoken;
+uint32_t BossLocked;
+
+// ******** InputIsr ************
+// About every 1 ms: the joystick moved
+void InputIsr(void){
+  OS_SemaSignal(&InputSema);
+}
+
+// ******** HogIsr ************
+// About every 3 ms: more work for Hog
+void HogIsr(void){
+  OS_SemaSignal(&HogSema);
+}
+
+// ******** Renderer ************
+// Priority 5: always drawing, part of it under LCDMutex
+void Renderer(void *arg){
+  for(;;){
+    OS_MutexLock(&LCDMutex);
+    Sim_Work(Sim_Range(CSMIN, CSMAX));
+    Draws++;
+    OS_MutexUnlock(&LCDMutex);
+    Sim_Work(Sim_Range(1000, 20000));
+  }
+}
+
+// ******** Input ************
+// Priority 1: lock, draw a little, unlock; times the lock
+void Input(void *arg){
+  for(;;){
+    OS_SemaWait(&InputSema);
+    uint64_t start = Sim_Now();
+    uint32_t hog = HogBusy;
+    OS_MutexLock(&LCDMutex);
+    uint64_t wait = Sim_Now() - start;
+    if(wait > MaxWait){
+      MaxWait = wait;
+    }
+    if(hog && (wait > 0)){
+      Inversions++;                // Hog was ready while Renderer held it
+    }
+    Inputs++;
+    Sim_Work(200);
+    OS_MutexUnlock(&LCDMutex);
+  }
+}
+
+// ******** Hog ************
+// Priority 3: 1 to 2.5 ms of work per release
+void Hog(void *arg){
+  for(;;){
+    OS_SemaWait(&HogSema);
+    HogBusy = 1;
+    Sim_Work(Sim_Range(80000, 200000));
+    HogBusy = 0;
+    Bursts++;
+  }
+}
+
+// ******** Owner ************
+// Priority 6: takes ChainMutex, then waits on ChainSema
+void Owner(void *arg){
+  OS_MutexLock(&ChainMutex);
+  OS_SemaWait(&ChainSema);
+  ChainOrder[ChainWoken++] = 'O';
+  OS_MutexUnlock(&ChainMutex);     // to Boss
+  for(;;){
+    OS_SemaWait(&ChainSema);
+  }
+}
+
+// ******** Other ************
+// Priority 4: waits on ChainSema, ahead of Owner until Boss comes
+void Other(void *arg){
+  OS_SemaWait(&ChainSema);
+  ChainOrder[ChainWoken++] = 'T';
+  for(;;){
+    OS_SemaWait(&ChainSema);
+  }
+}
+
+// ******** Boss ************
+// Priority 1: waits for ChainMutex, which boosts Owner
+void Boss(void *arg){
+  OS_MutexLock(&ChainMutex);
+  BossLocked = 1;
+  OS_MutexUnlock(&ChainMutex);
+  for(;;){
+    OS_SemaWait(&ChainSema);
+  }
+}
+
+// ******** Controller ************
+// Priority 0: sets up the chain scenario one thread at a time, each
+// runs while Controller sleeps, then starts the inversion scenario
+void Controller(void *arg){
+  OS_CreateThread(&Owner, NULL, NULL, 256, 6);
+  OS_Sleep(1);                     // Owner holds ChainMutex, waits
+  OS_CreateThread(&Other, NULL, NULL, 256, 4);
+  OS_Sleep(1);                     // Other waits ahead of Owner
+  OS_CreateThread(&Boss, NULL, NULL, 256, 1);
+  OS_Sleep(1);                     // Boss waits, Owner now priority 1
+  OS_SemaSignal(&ChainSema);       // must wake Owner
+  OS_Sleep(1);
+  OS_CreateThread(&Renderer, NULL, NULL, 256, 5);
+  OS_CreateThread(&Hog, NULL, NULL, 256, 3);
+  OS_CreateThread(&Input, NULL, NULL, 256, 1);
+  Sim_AddInterrupt(&InputIsr, 80000, 40000);
+  Sim_AddInterrupt(&HogIsr, 240000, 120000);
+  for(;;){
+    OS_SemaWait(&HogSema);         // never signaled for Controller
+  }
+}
+
+// ******** Report ************
+// At the end of the simulated time
+int Report(void){
+  uint32_t failed = 0;
+  ChainOrder[ChainWoken] = 0;
+  printf("chain      woken %-3s boss %s  %s\n", ChainOrder,
+         BossLocked ? "locked" : "blocked",
+         ((ChainOrder[0] == 'O') && BossLocked) ? "ok" : "FAIL");
+  failed |= !((ChainOrder[0] == 'O') && BossLocked);
+  printf("inversion  %u draws, %u inputs, %u behind Hog, %u Hog bursts\n",
+         Draws, Inputs, Inversions, Bursts);
+  printf("           longest wait %.2f us, critical section %.2f us  %s\n",
+         MaxWait/80.0, CSMAX/80.0,
+         ((MaxWait <= CSMAX) && (Inversions > 0)) ? "ok" : "FAIL");
+  failed |= (MaxWait > CSMAX) || (Inversions == 0);
+  return failed ? 1 : 0;
+}
+
+int main(void){
+  OS_Init();
+  OS_MutexInit(&LCDMutex);
+  OS_MutexInit(&ChainMutex);
+  OS_SemaInit(&InputSema, 0, OS_ORDER_FIFO);
+  OS_SemaInit(&HogSema, 0, OS_ORDER_FIFO);
+  OS_SemaInit(&ChainSema, 0, OS_ORDER_PRIORITY);
+  OS_CreateThread(&Controller, NULL, NULL, 256, 0);
+  Sim_OnEnd(&Report);
+  OS_Launch(TIMESLICE);
+  return 0;                        // never reached
+}
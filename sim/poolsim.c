@@ -0,0 +1,160 @@
+// poolsim.c
+// Runs on the host (make poolsim in sim/, then ./poolsim)
+// Checks of ospool.c on the simulated Cortex-M:
+//   bad frees   a pointer from outside the pool, one into the middle of
+//               a block, and second frees of blocks while others are
+//               held, the last one freed and an older one, must each
+//               count in badFrees and leave the free list intact
+//   stress      a device ISR allocates blocks a thread frees, while the
+//               thread allocates and frees its own around preemptible
+//               work; the free list and the bitmap must still agree
+// After each part every block is either on the free list once or
+// allocated, never both, and used matches. Exits with status 1 if
+// any check fails.
+
+#include <stdint.h>
+#include <stdio.h>
+#include "os.h"
+#include "ospool.h"
+#include "CortexM.h"
+#include "simport.h"
+
+#define TIMESLICE 80000            // 1 ms ticks
+#define BLOCKS    16
+#define HELD      64               // blocks the ISR can hand over
+
+OS_POOL_MEMORY(Memory, 22, BLOCKS);  // rounded up to 24 bytes
+OS_Pool_t Pool;
+
+void *Held[HELD];                  // allocated by the ISR, freed by Worker
+uint32_t NumHeld;
+uint32_t Failures;
+
+// ******** fail ************
+static void fail(const char *what){
+  printf("FAIL %s\n", what);
+  Failures++;
+}
+
+// ******** consistent ************
+// Walk the free list: each block on it once, none allocated, and
+// free plus used is every block
+static void consistent(const char *when){
+  uint32_t seen[BLOCKS] = {0};
+  uint32_t free = 0;
+  long sr = StartCritical();
+  for(uint8_t *b = Pool.free; b != NULL; b = *(void **)b){
+    uint32_t i = (uint32_t)(b - Pool.start)/Pool.blockSize;
+    if((i >= BLOCKS) || seen[i]++ || (Pool.allocated[i/32]&(1u<<(i%32)))
+       || (++free > BLOCKS)){
+      EndCritical(sr);
+      printf("%-10s ", when);
+      fail("free list corrupt");
+      return;
+    }
+  }
+  uint32_t used = Pool.used;
+  EndCritical(sr);
+  if(free + used != BLOCKS){
+    printf("%-10s %u free + %u used != %u  ", when, free, used, BLOCKS);
+    fail("count");
+    return;
+  }
+  printf("%-10s %2u free, %2u used  ok\n", when, free, used);
+}
+
+// ******** badFrees ************
+// The rejections, with blocks held so used is never 0
+static void badFrees(void){
+  int32_t local;
+  void *a = OS_PoolAlloc(&Pool);
+  void *b = OS_PoolAlloc(&Pool);
+  void *c = OS_PoolAlloc(&Pool);
+  OS_PoolFree(&Pool, &local);                  // not from the pool
+  OS_PoolFree(&Pool, (uint8_t *)Memory + 4);   // inside block 0
+  OS_PoolFree(&Pool, b);
+  OS_PoolFree(&Pool, b);           // the last one freed, once a self-loop
+  OS_PoolFree(&Pool, a);
+  OS_PoolFree(&Pool, b);           // an older free
+  OS_PoolStats_t stats;
+  OS_PoolStats(&Pool, &stats);
+  if((stats.badFrees != 4) || (stats.used != 1)){
+    printf("badFrees %u used %u  ", stats.badFrees, stats.used);
+    fail("bad frees not all rejected");
+  }
+  void *d = OS_PoolAlloc(&Pool);   // a and b come back, once each
+  void *e = OS_PoolAlloc(&Pool);
+  if((d == e) || (d == c) || (e == c)){
+    fail("a block was handed out twice");
+  }
+  consistent("bad frees");
+  OS_PoolFree(&Pool, c);
+  OS_PoolFree(&Pool, d);
+  OS_PoolFree(&Pool, e);
+  OS_PoolResetStats(&Pool);
+}
+
+// ******** DeviceIsr ************
+// About every 60 us: allocate a block for Worker to free
+void DeviceIsr(void){
+  void *block = OS_PoolAlloc(&Pool);
+  if(block == NULL){
+    return;
+  }
+  if(NumHeld < HELD){
+    Held[NumHeld++] = block;       // ISR, Worker masks around its side
+  } else{
+    OS_PoolFree(&Pool, block);
+  }
+}
+
+// ******** Worker ************
+// Priority 1: the rejections, then frees what the ISR allocated and
+// uses blocks of its own across preemptible work
+void Worker(void *arg){
+  consistent("start");
+  badFrees();
+  Sim_AddInterrupt(&DeviceIsr, 5000, 4000);
+  for(;;){
+    void *block = NULL;
+    long sr = StartCritical();
+    if(NumHeld > 0){
+      block = Held[--NumHeld];
+    }
+    EndCritical(sr);
+    OS_PoolFree(&Pool, block);
+    void *mine = OS_PoolAlloc(&Pool);
+    Sim_Work(Sim_Range(100, 3000));
+    OS_PoolFree(&Pool, mine);
+    if((Sim_Rand()%4) == 0){
+      OS_Sleep(1);
+    }
+  }
+}
+
+// ******** Report ************
+// At the end of the simulated time
+int Report(void){
+  OS_PoolStats_t stats;
+  OS_PoolStats(&Pool, &stats);
+  printf("stress     %u allocs, %u fails, peak %u of %u, %u bad frees\n",
+         stats.allocs, stats.fails, stats.peak, stats.blocks, stats.badFrees);
+  if((stats.badFrees != 0) || (stats.allocs == 0) || (stats.fails == 0)){
+    fail("stress");                // fails shows the pool ran dry
+  }
+  consistent("stress");
+  return Failures ? 1 : 0;
+}
+
+int main(void){
+  OS_Init();
+  OS_PoolInit(&Pool, Memory, 22, BLOCKS);
+  OS_PoolInit(&Pool, Memory, 22, BLOCKS);  // again, listed once
+  if((OS_PoolNext(NULL) != &Pool) || (OS_PoolNext(&Pool) != NULL)){
+    fail("pool list");
+  }
+  OS_CreateThread(&Worker, NULL, NULL, 256, 1);
+  Sim_OnEnd(&Report);
+  OS_Launch(TIMESLICE);
+  return 0;                        // never reached
+}
@@ -0,0 +1,201 @@
+// semasim.c
+// Runs on the host (make semasim in sim/, then ./semasim)
+// Sixteen threads at four priorities wait on one semaphore at a time:
+//   Sema_t OS_ORDER_FIFO      must wake them in the order they waited
+//   Sema_t OS_ORDER_PRIORITY  highest priority first, FIFO among equals
+//   int32_t OS_Wait/OS_Signal the legacy queue, FIFO
+// Then a priority 0 thread times OS_SemaSignal, which runs with the
+// kernel masked from start to end, at every queue length from 16 down
+// to 1 waiter. Times are host nanoseconds, the least of ROUNDS rounds
+// at each length so host noise drops out. The signal takes the head of
+// the queue without a search, so 16 waiters must cost no more than
+// BOUND times 1 waiter.
+// Exits with status 1 if any order or bound check fails.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "os.h"
+#include "CortexM.h"
+#include "simport.h"
+
+#define TIMESLICE 80000            // 1 ms ticks
+#define WAITERS   16
+#define ROUNDS    200              // one tick each, inside SIM_MS
+#define BOUND     2
+
+// four waiters at each of priorities 1 to 4, created in this order
+static const uint32_t Priority[WAITERS] = {3, 1, 4, 1, 2, 4, 2, 3, 1, 3, 2, 4, 1, 2, 3, 4};
+
+Sema_t FifoSema, PrioSema, TimeFifo, TimePrio, Finished;
+int32_t OldSema;
+
+// Thread ids in the order they were woken
+typedef struct{
+  uint32_t count;
+  uint32_t id[WAITERS];
+} order_t;
+order_t FifoOrder, PrioOrder, LegacyOrder;
+
+// Least host ns of OS_SemaSignal with WAITERS-i threads waiting
+uint64_t FifoNs[WAITERS], PrioNs[WAITERS];
+
+uint32_t Failures;
+
+// ******** nowNs ************
+static uint64_t nowNs(void){
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+// ******** record ************
+static void record(order_t *order, uint32_t id){
+  if(order->count < WAITERS){
+    order->id[order->count] = id;
+  }
+  order->count++;
+}
+
+// ******** Waiter ************
+// Priority Priority[id]: each semaphore once, in turn, then the
+// timing semaphores forever
+void Waiter(void *arg){
+  uint32_t id = (uint32_t)arg;
+  OS_SemaWait(&FifoSema);
+  record(&FifoOrder, id);
+  OS_SemaWait(&PrioSema);
+  record(&PrioOrder, id);
+  OS_Wait(&OldSema);
+  record(&LegacyOrder, id);
+  for(;;){
+    OS_SemaWait(&TimeFifo);
+    OS_SemaWait(&TimePrio);
+  }
+}
+
+// ******** check ************
+// Compare a wake order with the expected one, print both on a mismatch
+static void check(const char *name, order_t *order, const uint32_t *expected){
+  uint32_t bad = (order->count != WAITERS);
+  for(uint32_t i = 0; (i < WAITERS) && !bad; i++){
+    bad = (order->id[i] != expected[i]);
+  }
+  printf("%-10s %s\n", name, bad ? "FAIL" : "ok");
+  if(bad){
+    printf("  woken   ");
+    for(uint32_t i = 0; (i < order->count) && (i < WAITERS); i++){
+      printf(" %u", order->id[i]);
+    }
+    printf("\n  expected");
+    for(uint32_t i = 0; i < WAITERS; i++){
+      printf(" %u", expected[i]);
+    }
+    printf("\n");
+    Failures++;
+  }
+}
+
+// ******** timeSignals ************
+// Signal every waiter off sema, timing each call into least[]
+static void timeSignals(Sema_t *sema, uint64_t *least){
+  for(uint32_t i = 0; i < WAITERS; i++){
+    uint64_t start = nowNs();
+    OS_SemaSignal(sema);           // the waiter is lower, no switch
+    uint64_t ns = nowNs() - start;
+    if(ns < least[i]){
+      least[i] = ns;
+    }
+  }
+}
+
+// ******** Signaller ************
+// Priority 0: the timing rounds, the report, the end of the run
+void Signaller(void *arg){
+  for(uint32_t i = 0; i < WAITERS; i++){
+    FifoNs[i] = UINT64_MAX;
+    PrioNs[i] = UINT64_MAX;
+  }
+  for(uint32_t r = 0; r < ROUNDS; r++){
+    timeSignals(&TimeFifo, FifoNs);
+    OS_Sleep(1);                   // the waiters move on to TimePrio
+    timeSignals(&TimePrio, PrioNs);
+    OS_Sleep(1);
+  }
+  printf("\nOS_SemaSignal, host ns, least of %u rounds\n", ROUNDS);
+  printf("waiting     fifo   priority\n");
+  uint64_t worst = 0;
+  for(uint32_t i = 0; i < WAITERS; i++){
+    printf("%7u %8llu %10llu\n", WAITERS - i,
+           (unsigned long long)FifoNs[i], (unsigned long long)PrioNs[i]);
+    if(FifoNs[i] > worst) worst = FifoNs[i];
+    if(PrioNs[i] > worst) worst = PrioNs[i];
+  }
+  uint64_t one = FifoNs[WAITERS-1];
+  if(PrioNs[WAITERS-1] < one){
+    one = PrioNs[WAITERS-1];
+  }
+  uint32_t bad = (worst > BOUND*one);
+  printf("worst %llu ns, %s %u times 1 waiter\n", (unsigned long long)worst,
+         bad ? "FAIL, over" : "ok, within", BOUND);
+  Failures += bad;
+  fflush(stdout);
+  exit(Failures ? 1 : 0);
+}
+
+// ******** Bench ************
+// Priority 6, below every waiter, so each signal runs the woken
+// thread at once and it records itself before the next signal
+void Bench(void *arg){
+  static uint32_t fifo[WAITERS], prio[WAITERS];
+  for(uint32_t i = 0; i < WAITERS; i++){
+    if(OS_CreateThread(&Waiter, (void *)i, NULL, 256, Priority[i]) == 0){
+      printf("could not create waiter %u\n", i);
+      exit(1);
+    }
+    fifo[i] = i;                   // each waited as soon as it was created
+  }
+  uint32_t n = 0;                  // stable sort by priority
+  for(uint32_t p = 1; p <= 4; p++){
+    for(uint32_t i = 0; i < WAITERS; i++){
+      if(Priority[i] == p) prio[n++] = i;
+    }
+  }
+  for(uint32_t i = 0; i < WAITERS; i++){
+    OS_SemaSignal(&FifoSema);
+  }
+  for(uint32_t i = 0; i < WAITERS; i++){
+    OS_SemaSignal(&PrioSema);
+  }
+  for(uint32_t i = 0; i < WAITERS; i++){
+    OS_Signal(&OldSema);
+  }
+  check("fifo", &FifoOrder, fifo);
+  check("priority", &PrioOrder, prio);
+  check("legacy", &LegacyOrder, prio);  // waited in priority order
+  OS_CreateThread(&Signaller, NULL, NULL, 256, 0);
+  OS_SemaWait(&Finished);          // Signaller ends the run
+}
+
+// ******** timeout ************
+// The time ran out before Signaller finished
+static int timeout(void){
+  printf("SIM_MS too short for %u rounds\n", ROUNDS);
+  return 1;
+}
+
+int main(void){
+  OS_Init();
+  OS_SemaInit(&FifoSema, 0, OS_ORDER_FIFO);
+  OS_SemaInit(&PrioSema, 0, OS_ORDER_PRIORITY);
+  OS_SemaInit(&TimeFifo, 0, OS_ORDER_FIFO);
+  OS_SemaInit(&TimePrio, 0, OS_ORDER_PRIORITY);
+  OS_SemaInit(&Finished, 0, OS_ORDER_FIFO);
+  OS_InitSemaphore(&OldSema, 0);
+  OS_CreateThread(&Bench, NULL, NULL, 256, 6);
+  Sim_OnEnd(&timeout);
+  OS_Launch(TIMESLICE);
+  return 0;                        // never reached
+}
@@ -0,0 +1,156 @@
+// simbsp.c
+// Runs on the host
+// The board the game talks to: BSP.h, comm_lib.h and UART0.h without
+// hardware. Output devices only charge the simulated time the real
+// ones take; inputs are seeded, so the player and the other board
+// behave the same way on every run with the same SIM_SEED.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "BSP.h"
+#include "UART0.h"
+#include "comm_lib.h"
+#include "simport.h"
+
+// ST7735 over SSI0: 16 bits a pixel plus setting the address window
+#define PIXELCYCLES   160
+#define WINDOWCYCLES  400
+#define CHARCYCLES    (80000000/11520)   // 115200 bps, 10 bits a character
+
+static FILE *Uart;
+
+// ******** lcdWork ************
+// Charge one drawing call covering w*h pixels
+static void lcdWork(int32_t w, int32_t h){
+  if((w <= 0) || (h <= 0)){
+    return;
+  }
+  Sim_Work(WINDOWCYCLES + (uint32_t)(w*h)*PIXELCYCLES);
+}
+
+void BSP_Clock_InitFastest(void){
+}
+
+uint32_t BSP_Clock_GetFreq(void){
+  return 80000000;
+}
+
+void BSP_LCD_Init(void){
+  Sim_Work(120*80000);             // the reset and sleep-out delays
+}
+
+void BSP_LCD_DrawFastVLine(int16_t x, int16_t y, int16_t h, uint16_t color){
+  lcdWork(1, h);
+}
+
+void BSP_LCD_FillScreen(uint16_t color){
+  lcdWork(128, 128);
+}
+
+void BSP_LCD_FillRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color){
+  lcdWork(w, h);
+}
+
+uint32_t BSP_LCD_DrawString(uint16_t x, uint16_t y, char *pt, int16_t textColor){
+  uint32_t count = 0;
+  while(pt[count]){
+    count++;
+  }
+  lcdWork(6*count, 8);
+  return count;
+}
+
+// the player steers toward a new spot every second or so
+static uint16_t JoyX = 512, JoyY = 512, JoyTarget = 512;
+
+void BSP_Joystick_Init(void){
+}
+
+void BSP_Joystick_Input(uint16_t *x, uint16_t *y, uint8_t *select){
+  static const uint16_t targets[3] = {150, 512, 870};
+  if(Sim_Range(0, 29) == 0){
+    JoyTarget = targets[Sim_Range(0, 2)];
+  }
+  if(JoyX + 60 < JoyTarget) JoyX += 60;
+  else if(JoyX > JoyTarget + 60) JoyX -= 60;
+  else JoyX = JoyTarget;
+  Sim_Work(2*80*4);                // two ADC conversions, about 4 usec each
+  *x = JoyX;
+  *y = JoyY;
+  *select = 1;
+}
+
+// ******** pulse ************
+// A seeded on/off signal: high for width cycles, then low for a
+// random gap from gapMin to gapMax cycles, starting low
+typedef struct{
+  uint64_t start;                  // cycle the current or next high starts
+  uint32_t width;
+  uint32_t gapMin, gapMax;
+} pulse_t;
+
+static bool pulseHigh(pulse_t *pulse){
+  uint64_t now = Sim_Now();
+  if(pulse->start == 0){
+    pulse->start = now + Sim_Range(pulse->gapMin, pulse->gapMax);
+  }
+  while(now >= pulse->start + pulse->width){
+    pulse->start += pulse->width + Sim_Range(pulse->gapMin, pulse->gapMax);
+  }
+  return now >= pulse->start;
+}
+
+// the other board's 20 ms trigger, and button S2 held for 100 ms
+static pulse_t Peer = {0, 20*80000, 500*80000, 3000*80000};
+static pulse_t Button = {0, 100*80000, 1000*80000, 4000*80000};
+static bool Led;
+
+void Comm_Init(void){
+}
+
+void Comm_SendTrigger(void){
+  Sim_Work(20*80000);              // the 600,000 iteration delay loop
+}
+
+bool Comm_CheckReceived(void){
+  return pulseHigh(&Peer);
+}
+
+bool Button_IsPressed(void){
+  return pulseHigh(&Button);
+}
+
+bool Button_Reset_IsPressed(void){
+  return false;
+}
+
+void LED_Set(bool on){
+  Led = on;
+}
+
+void UART0_Init(void){
+  const char *name = getenv("SIM_UART");
+  if((name != NULL) && (Uart == NULL)){
+    Uart = fopen(name, "wb");
+    if(Uart == NULL){
+      perror(name);
+    }
+  }
+}
+
+void UART0_OutChar(char data){
+  Sim_Work(CHARCYCLES);
+  if(Uart != NULL){
+    fputc(data, Uart);
+    fflush(Uart);
+  }
+}
+
+void UART0_OutString(char *pt){
+  while(*pt){
+    UART0_OutChar(*pt);
+    pt++;
+  }
+}
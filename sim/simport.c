@@ -0,0 +1,538 @@
+// simport.c
+// Runs on the host (x86-64 Linux, glibc)
+// A simulated Cortex-M4 for os.c, standing in for the startup code,
+// osasm.s and the core peripherals so the kernel builds unchanged.
+//   PRIMASK   StartCritical, EndCritical, DisableInterrupts and
+//             EnableInterrupts keep the I bit, and take any pending
+//             interrupt the moment it clears
+//   BASEPRI   OS_StartCritical and OS_EndCritical, with OS_BASEPRI,
+//             mask OS_KERNELCEILING and below the same way; without
+//             it they are StartCritical and EndCritical
+//   SysTick   a 24-bit down counter with the hardware's reload rules,
+//             driven by simulated cycles; counting to 0 pends it
+//   PendSV    lowest priority, runs Scheduler() and swaps ucontexts
+//             when RunPt changed
+//   DWT       CYCCNT counts simulated cycles once CYCCNTENA is set
+//   WFI       jumps straight to the next interrupt
+// Interrupts nest by priority as in the NVIC: devices from
+// Sim_AddInterrupt are at 5 unless Sim_InterruptPriority moves them,
+// SysTick at 6 and PendSV at 7, so PendSV only runs from a thread.
+// A pending interrupt preempts when its priority number is below the
+// running one's and below BASEPRI, and the I bit is clear. Each thread runs on its own host stack, created the first
+// time PendSV or StartOS switches to its TCB. The task and argument
+// come from the initial frame SetInitialStack built (PC and R0), which
+// holds them as 32-bit words, so the program must be linked -no-pie
+// and thread arguments must be static, not on a host stack.
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include "CortexM.h"
+#include "os.h"
+#include "simport.h"
+
+#define SIMTHREADS 80              // host contexts, one per TCB that runs
+#define SIMSTACK   (256*1024)      // host stack bytes per thread
+#define SIMDEVICES 8
+#define CORECLOCK  80000000
+
+#define PENDSVSET  0x10000000      // INTCTRL bits
+#define PENDSTSET  0x04000000
+
+#define THREADPRI  8               // execution priority of thread mode
+#define DEVICEPRI  5               // default device priority
+#define SYSTICKPRI 6               // as OS_Launch sets them
+#define PENDSVPRI  7
+
+struct tcb;                        // os.c's, sp is its first member
+extern struct tcb *RunPt;
+void Scheduler(void);
+void SysTick_Handler(void);
+
+volatile uint32_t SimReg[SIM_REGS];
+
+typedef struct{
+  int32_t *sp;                     // the TCB's initial stack pointer
+  void (*task)(void *);
+  void *arg;
+  ucontext_t context;
+} simthread_t;
+
+typedef struct{
+  void (*handler)(void);
+  uint32_t period;
+  uint32_t jitter;
+  uint64_t next;                   // cycle of the next interrupt
+  uint64_t raised;                 // cycle the pending one was due
+  uint32_t pending;
+  uint32_t priority;               // 0 to 7, 0 highest
+} simdevice_t;
+
+static simthread_t Threads[SIMTHREADS];
+static uint32_t NumSimThreads;
+static simthread_t *Current;       // NULL until StartOS
+static ucontext_t MainContext;
+static simdevice_t Devices[SIMDEVICES];
+static uint32_t NumDevices;
+
+static uint64_t Cycles;            // simulated time
+static uint64_t Limit;             // the run ends here
+static uint64_t IdleCycles;
+static uint32_t Wakeups;           // WaitForInterrupt calls that slept
+static uint64_t PrimaskSince;      // when the I bit was last set
+static uint64_t PrimaskMax;        // longest it stayed set, after StartOS
+static uint64_t BasepriSince;      // when BASEPRI was last raised from 0
+static uint64_t BasepriMax;
+static uint64_t RandState;
+static uint32_t Seed = 1;
+static uint32_t Verbose;
+static uint32_t Primask;           // the I bit
+static uint32_t Basepri;           // priorities it masks, 1 to 7, 0 for none
+static uint32_t ExecPriority = THREADPRI;  // of the running code
+static uint64_t Raised;            // when the running device's interrupt was due
+static uint32_t TickPending;
+static uint32_t PendSvPending;
+static uint32_t Ending;            // the report is running, time stands still
+static uint64_t Digest = 0xCBF29CE484222325ULL;  // FNV-1a
+static uint32_t Switches;
+static int (*Report)(void);
+
+// ******** SimEnd ************
+// Stop the run, from whichever thread or handler got there
+static void SimEnd(int status){
+  Ending = 1;
+  if((status == 0) && (Report != NULL)){
+    status = Report();
+  } else if(status == 0){
+    printf("seed %u, %.3f ms, %u context switches, digest %016llx\n", Seed,
+           Cycles/(CORECLOCK/1e3), Switches, (unsigned long long)Digest);
+    printf("%.1f%% idle, %.0f wakeups/s, masked up to %.2f us (I bit), %.2f us (BASEPRI)\n",
+           100.0*IdleCycles/Cycles, Wakeups/(Cycles/(double)CORECLOCK),
+           PrimaskMax/(CORECLOCK/1e6), BasepriMax/(CORECLOCK/1e6));
+    OS_PeriodicStats_t stats;
+    for(uint32_t i = 0; OS_PeriodicStats(i, &stats); i++){
+      printf("event %u, %u runs, %u missed, late %.2f to %.2f us, runs up to %.2f us\n",
+             i, stats.runs, stats.missed, stats.minLate/(CORECLOCK/1e6),
+             stats.maxLate/(CORECLOCK/1e6), stats.maxExec/(CORECLOCK/1e6));
+    }
+  }
+  fflush(stdout);
+  exit(status);
+}
+
+// ******** SimPrimask ************
+// Set the I bit, timing how long it stays set once threads run
+static void SimPrimask(uint32_t primask){
+  if(primask && !Primask){
+    PrimaskSince = Cycles;
+  } else if(!primask && Primask && (Current != NULL)
+            && (Cycles - PrimaskSince > PrimaskMax)){
+    PrimaskMax = Cycles - PrimaskSince;
+  }
+  Primask = primask;
+}
+
+// ******** SimSync ************
+// INTCTRL is a plain variable the kernel writes PENDSVSET into, which
+// would clear PENDSTSET. Move the write into our own flag, then show
+// PENDSTSET again, the one bit the kernel reads
+static void SimSync(void){
+  if(INTCTRL & PENDSVSET){
+    PendSvPending = 1;
+  }
+  INTCTRL = TickPending ? PENDSTSET : 0;
+}
+
+// ******** TickDue ************
+// Cycles until SysTick next reaches 0, a reload takes one
+static uint64_t TickDue(void){
+  if(!(STCTRL & 1) || (STRELOAD == 0)){
+    return UINT64_MAX;
+  }
+  if(STCURRENT == 0){
+    return 1 + (uint64_t)(STRELOAD & 0x00FFFFFF);
+  }
+  return STCURRENT;
+}
+
+// ******** DeviceDue ************
+// Cycles until the next device interrupt
+static uint64_t DeviceDue(void){
+  uint64_t due = UINT64_MAX;
+  for(uint32_t i = 0; i < NumDevices; i++){
+    if(Devices[i].next - Cycles < due){
+      due = Devices[i].next - Cycles;
+    }
+  }
+  return due;
+}
+
+// ******** SimAdvance ************
+// Move time forward by at most the cycles to the next interrupt source
+static void SimAdvance(uint64_t step){
+  if(Cycles + step > Limit){
+    step = Limit - Cycles;
+  }
+  Cycles += step;
+  if(DWT_CTRL & 1){
+    DWT_CYCCNT += (uint32_t)step;
+  }
+  if(STCTRL & 1){
+    uint64_t left = step;
+    while(left > 0){
+      if(STCURRENT == 0){          // reload cycle
+        STCURRENT = STRELOAD & 0x00FFFFFF;
+        left--;
+      } else{
+        uint32_t count = (left < STCURRENT) ? (uint32_t)left : STCURRENT;
+        STCURRENT -= count;
+        left -= count;
+        if((STCURRENT == 0) && (STCTRL & 2)){
+          TickPending = 1;
+        }
+      }
+      if(STRELOAD == 0) break;
+    }
+  }
+  for(uint32_t i = 0; i < NumDevices; i++){
+    simdevice_t *device = &Devices[i];
+    if(device->next <= Cycles){
+      if(!device->pending){
+        device->raised = device->next;
+      }
+      device->pending = 1;
+      device->next += device->period - device->jitter/2 + Sim_Range(0, device->jitter);
+    }
+  }
+  SimSync();
+  if(Cycles >= Limit){
+    SimEnd(0);
+  }
+}
+
+// ******** SimThreadStart ************
+// First code on a new host stack
+static void SimThreadStart(void){
+  Current->task(Current->arg);
+  fprintf(stderr, "sim: thread %u returned, the board would fault\n",
+          (uint32_t)(Current - Threads));
+  SimEnd(3);
+}
+
+// ******** SimThread ************
+// The host context of a TCB, made on first use
+static simthread_t *SimThread(struct tcb *thread){
+  int32_t *sp = *(int32_t **)thread;
+  for(uint32_t i = 0; i < NumSimThreads; i++){
+    if(Threads[i].sp == sp){
+      return &Threads[i];
+    }
+  }
+  if(NumSimThreads == SIMTHREADS){
+    fprintf(stderr, "sim: more than %d threads\n", SIMTHREADS);
+    SimEnd(3);
+  }
+  simthread_t *new = &Threads[NumSimThreads++];
+  new->sp = sp;
+  new->task = (void(*)(void *))(uintptr_t)(uint32_t)sp[15];  // PC
+  new->arg = (void *)(uintptr_t)(uint32_t)sp[9];             // R0
+  getcontext(&new->context);
+  new->context.uc_stack.ss_sp = malloc(SIMSTACK);
+  new->context.uc_stack.ss_size = SIMSTACK;
+  new->context.uc_link = NULL;
+  if(new->context.uc_stack.ss_sp == NULL){
+    fprintf(stderr, "sim: out of host memory\n");
+    SimEnd(3);
+  }
+  makecontext(&new->context, SimThreadStart, 0);
+  return new;
+}
+
+// ******** SimSwitch ************
+// Run RunPt's context if it is not the one running
+static void SimSwitch(void){
+  simthread_t *next = SimThread(RunPt);
+  if(next == Current){
+    return;
+  }
+  uint32_t id = (uint32_t)(next - Threads);
+  for(int i = 0; i < 8; i++){
+    Digest = (Digest ^ ((Cycles>>(8*i))&0xFF))*0x100000001B3ULL;
+  }
+  Digest = (Digest ^ id)*0x100000001B3ULL;
+  Switches++;
+  if(Verbose){
+    printf("%12.3f us  thread %u\n", Cycles/(CORECLOCK/1e6), id);
+  }
+  simthread_t *previous = Current;
+  Current = next;
+  if(previous == NULL){
+    swapcontext(&MainContext, &next->context);
+  } else{
+    swapcontext(&previous->context, &next->context);
+  }
+}
+
+// ******** SimTakes ************
+// 1 if an interrupt at this priority preempts the running code now
+static uint32_t SimTakes(uint32_t priority){
+  return !Primask && !Ending && (priority < ExecPriority)
+         && ((Basepri == 0) || (priority < Basepri));
+}
+
+// ******** SimPoll ************
+// Take every pending interrupt the masks and the running priority
+// allow, highest priority first, each one nesting over the caller
+static void SimPoll(void){
+  SimSync();
+  while(1){
+    simdevice_t *device = NULL;
+    for(uint32_t i = 0; i < NumDevices; i++){
+      if(Devices[i].pending
+         && ((device == NULL) || (Devices[i].priority < device->priority))){
+        device = &Devices[i];
+      }
+    }
+    uint32_t interrupted = ExecPriority;
+    if((device != NULL) && SimTakes(device->priority)){
+      uint64_t raised = Raised;
+      device->pending = 0;
+      Raised = device->raised;
+      ExecPriority = device->priority;
+      device->handler();
+      Raised = raised;
+    } else if(TickPending && SimTakes(SYSTICKPRI)){
+      TickPending = 0;
+      SimSync();
+      ExecPriority = SYSTICKPRI;
+      SysTick_Handler();
+    } else if(PendSvPending && SimTakes(PENDSVPRI)){
+      PendSvPending = 0;
+      SimSync();
+      ExecPriority = PENDSVPRI;
+      Scheduler();
+      ExecPriority = interrupted;
+      SimSwitch();                 // back here when this thread runs again
+    } else{
+      break;
+    }
+    ExecPriority = interrupted;
+    SimSync();
+  }
+}
+
+void DisableInterrupts(void){
+  SimPrimask(1);
+  SimSync();
+}
+
+void EnableInterrupts(void){
+  SimPrimask(0);
+  SimPoll();
+}
+
+long StartCritical(void){
+  long sr = Primask;
+  SimPrimask(1);
+  SimSync();
+  return sr;
+}
+
+void EndCritical(long sr){
+  SimPrimask((uint32_t)sr);
+  SimPoll();
+}
+
+#ifdef OS_BASEPRI
+// BASEPRI_MAX: only ever raises the mask
+long OS_StartCritical(void){
+  long sr = Basepri;
+  if(Basepri == 0){
+    BasepriSince = Cycles;
+  }
+  if((Basepri == 0) || (Basepri > OS_KERNELCEILING)){
+    Basepri = OS_KERNELCEILING;
+  }
+  SimSync();
+  return sr;
+}
+
+void OS_EndCritical(long sr){
+  if((sr == 0) && Basepri && (Cycles - BasepriSince > BasepriMax)){
+    BasepriMax = Cycles - BasepriSince;
+  }
+  Basepri = (uint32_t)sr;
+  SimPoll();
+}
+#else
+long OS_StartCritical(void){
+  return StartCritical();
+}
+
+void OS_EndCritical(long sr){
+  EndCritical(sr);
+}
+#endif
+
+// ******** WaitForInterrupt ************
+// Skip to the next interrupt. Like WFI it wakes with the I bit set,
+// the interrupt is taken once the caller enables interrupts; one the
+// masks allow, above OS_KERNELCEILING with OS_BASEPRI, is taken here
+void WaitForInterrupt(void){
+  SimSync();
+  if(TickPending || PendSvPending){
+    return;
+  }
+  for(uint32_t i = 0; i < NumDevices; i++){
+    if(Devices[i].pending) return;
+  }
+  uint64_t due = TickDue();
+  if(DeviceDue() < due){
+    due = DeviceDue();
+  }
+  if(due == UINT64_MAX){
+    fprintf(stderr, "sim: WaitForInterrupt with no interrupt left to wake it\n");
+    SimEnd(2);
+  }
+  IdleCycles += due;
+  Wakeups++;
+  SimAdvance(due);
+  PrimaskSince = BasepriSince = Cycles;  // asleep, nothing was held off
+  SimPoll();
+}
+
+// ******** OS_WaitForInterrupt ************
+// osasm.s trades BASEPRI for the I bit around its WFI, so any
+// interrupt wakes it, which WaitForInterrupt does already
+void OS_WaitForInterrupt(void){
+  WaitForInterrupt();
+}
+
+// ******** StartOS ************
+// osasm.s loads RunPt's frame and enables interrupts; here the main
+// context gives way to RunPt's and is never resumed
+void StartOS(void){
+  Primask = 0;                     // the start-up section is not timed
+  SimSwitch();
+  fprintf(stderr, "sim: StartOS returned\n");
+  SimEnd(3);
+}
+
+void Sim_Work(uint32_t cycles){
+  uint64_t left = cycles;
+  while((left > 0) && !Ending){
+    uint64_t step = left;
+    if(TickDue() < step) step = TickDue();
+    if(DeviceDue() < step) step = DeviceDue();
+    SimAdvance(step);
+    left -= step;
+    SimPoll();
+  }
+}
+
+uint32_t Sim_Rand(void){
+  RandState ^= RandState >> 12;    // xorshift64*
+  RandState ^= RandState << 25;
+  RandState ^= RandState >> 27;
+  return (uint32_t)((RandState*0x2545F4914F6CDD1DULL)>>32);
+}
+
+uint32_t Sim_Range(uint32_t lo, uint32_t hi){
+  if(hi <= lo){
+    return lo;
+  }
+  return lo + Sim_Rand()%(hi - lo + 1);
+}
+
+int Sim_AddInterrupt(void(*handler)(void), uint32_t period, uint32_t jitter){
+  if((NumDevices == SIMDEVICES) || (period == 0) || (jitter >= period)){
+    return 0;
+  }
+  simdevice_t *device = &Devices[NumDevices];
+  device->handler = handler;
+  device->period = period;
+  device->jitter = jitter;
+  device->next = Cycles + period;
+  device->raised = 0;
+  device->pending = 0;
+  device->priority = DEVICEPRI;
+  NumDevices++;
+  return 1;
+}
+
+int Sim_InterruptPriority(void(*handler)(void), uint32_t priority){
+  if(priority > 7){
+    return 0;
+  }
+  for(uint32_t i = 0; i < NumDevices; i++){
+    if(Devices[i].handler == handler){
+      Devices[i].priority = priority;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+uint32_t Sim_Latency(void){
+  return (uint32_t)(Cycles - Raised);
+}
+
+uint64_t Sim_Now(void){
+  return Cycles;
+}
+
+uint32_t Sim_Seed(void){
+  return Seed;
+}
+
+uint64_t Sim_Digest(void){
+  return Digest;
+}
+
+uint32_t Sim_Switches(void){
+  return Switches;
+}
+
+uint64_t Sim_IdleCycles(void){
+  return IdleCycles;
+}
+
+uint32_t Sim_Wakeups(void){
+  return Wakeups;
+}
+
+uint32_t Sim_PrimaskMax(void){
+  return (uint32_t)PrimaskMax;
+}
+
+uint32_t Sim_BasepriMax(void){
+  return (uint32_t)BasepriMax;
+}
+
+void Sim_OnEnd(int(*report)(void)){
+  Report = report;
+}
+
+// ******** SimSetup ************
+// Reset state and the settings from the environment, before main
+__attribute__((constructor)) static void SimSetup(void){
+  const char *text;
+  if((uintptr_t)&SimThreadStart > 0xFFFFFFFF){
+    fprintf(stderr, "sim: code above 4 GB, build with -fno-pie -no-pie\n");
+    exit(3);
+  }
+  if((text = getenv("SIM_SEED")) != NULL){
+    Seed = (uint32_t)strtoul(text, NULL, 0);
+  }
+  RandState = 0x9E3779B97F4A7C15ULL*((uint64_t)Seed + 1);
+  uint32_t ms = 1000;
+  if((text = getenv("SIM_MS")) != NULL){
+    ms = (uint32_t)strtoul(text, NULL, 0);
+  }
+  Limit = (uint64_t)ms*(CORECLOCK/1000);
+  if((text = getenv("SIM_VERBOSE")) != NULL){
+    Verbose = (uint32_t)strtoul(text, NULL, 0);
+  }
+}
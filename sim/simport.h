@@ -0,0 +1,106 @@
+// simport.h
+// Runs on the host
+// Control of the simulated Cortex-M the kernel runs on. Time is
+// simulated core cycles at 80 MHz: it only moves when code calls
+// Sim_Work or every thread is asleep in WaitForInterrupt, so a run
+// depends on nothing but the seed and repeats tick for tick.
+// Settings come from the environment, read before main:
+//   SIM_SEED     seed for Sim_Rand, default 1
+//   SIM_MS       simulated milliseconds to run, default 1000
+//   SIM_VERBOSE  1 prints every context switch
+//   SIM_UART     file that receives UART0 output, default none
+
+#ifndef __SIMPORT_H
+#define __SIMPORT_H  1
+
+#include <stdint.h>
+
+// ******** Sim_Work ************
+// Spend simulated time in the caller, the stand-in for the code the
+// real target would execute. Interrupts due in the meantime are taken
+// as soon as the masks and the running priority allow, so a thread or
+// ISR can be preempted inside
+// Inputs:  core cycles, 80 per usec
+// Outputs: none
+void Sim_Work(uint32_t cycles);
+
+// ******** Sim_Rand ************
+// Next number of the seeded xorshift generator
+// Inputs:  none
+// Outputs: 32 random bits
+uint32_t Sim_Rand(void);
+
+// ******** Sim_Range ************
+// Seeded random number from lo to hi, inclusive
+uint32_t Sim_Range(uint32_t lo, uint32_t hi);
+
+// ******** Sim_AddInterrupt ************
+// A virtual device that interrupts every period cycles, plus or minus
+// up to jitter/2, from the next Sim_Work or idle period on. Its
+// handler runs at priority 5, so it preempts SysTick and PendSV
+// Inputs:  handler, runs as an ISR
+//          period and jitter in core cycles, jitter < period
+// Outputs: 1 if successful, 0 if there are too many devices
+int Sim_AddInterrupt(void(*handler)(void), uint32_t period, uint32_t jitter);
+
+// ******** Sim_InterruptPriority ************
+// Move a device to another NVIC priority, as NVIC_PRIn_R does. Below
+// OS_KERNELCEILING it preempts the kernel's critical sections when
+// built with OS_BASEPRI, and must make no OS_ calls
+// Inputs:  handler given to Sim_AddInterrupt
+//          priority, 0 is highest, 7 is lowest
+// Outputs: 1 if successful, 0 if there is no such device
+int Sim_InterruptPriority(void(*handler)(void), uint32_t priority);
+
+// ******** Sim_Latency ************
+// Called first thing in a device's handler: core cycles from the
+// moment its interrupt was due to now, the time it was held off
+uint32_t Sim_Latency(void);
+
+// ******** Sim_Now ************
+// Simulated core cycles since start-up, 64 bits
+uint64_t Sim_Now(void);
+
+// ******** Sim_Seed ************
+// The seed this run uses
+uint32_t Sim_Seed(void);
+
+// ******** Sim_Digest ************
+// Hash of every context switch so far, time and thread. Two runs
+// with the same seed and build print the same digest
+uint64_t Sim_Digest(void);
+
+// ******** Sim_Switches ************
+// Context switches so far
+uint32_t Sim_Switches(void);
+
+// ******** Sim_IdleCycles ************
+// Cycles the CPU spent asleep in WaitForInterrupt
+uint64_t Sim_IdleCycles(void);
+
+// ******** Sim_Wakeups ************
+// Times WaitForInterrupt slept until an interrupt, the CPU's wakeups
+uint32_t Sim_Wakeups(void);
+
+// ******** Sim_PrimaskMax ************
+// Longest time the I bit stayed set since OS_Launch, in cycles: the
+// most any interrupt was held off. Sleep in WaitForInterrupt is not
+// counted, the interrupt that ends it is taken at once
+uint32_t Sim_PrimaskMax(void);
+
+// ******** Sim_BasepriMax ************
+// The same for BASEPRI raised by OS_StartCritical with OS_BASEPRI,
+// what interrupts at OS_KERNELCEILING and below wait for; 0 without.
+// Interrupts above the ceiling that run meanwhile count in it
+uint32_t Sim_BasepriMax(void);
+
+// ******** Sim_OnEnd ************
+// Called when the simulated time runs out, its return value is the
+// exit status. Without one the run prints the seed, the switch count,
+// the digest, the idle share, the wakeups and the masked times, and
+// exits with status 0
+// Inputs:  report function, runs on the thread that was running
+// Outputs: none
+void Sim_OnEnd(int(*report)(void));
+
+#endif
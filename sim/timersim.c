@@ -0,0 +1,214 @@
+// timersim.c
+// Runs on the host (make timersim in sim/, then ./timersim)
+// 2000 software timers on the simulated Cortex-M. A thread and a
+// device ISR keep starting, restarting and stopping random timers:
+// one-shot and periodic, due now, within 100 ticks, within 9000 (the
+// second wheel level) and up to 300000 (the third). A model of what
+// each timer should do is kept alongside, under the same masked
+// section as each call. The daemon runs at priority 0 with a busy
+// thread below it. The report fails the run if:
+//   a callback came before its timer was due
+//   a callback came for a timer that was stopped or had fired
+//   an armed timer is more than 2 ticks overdue at the end
+//   OS_TimerStats does not count every callback
+//   the tick count strays from the simulated time; the ISR wakes
+//   tickless idle early over and over, each wake must credit only
+//   the ticks that really passed
+//   the daemon writes into a pooled timer whose callback stopped it,
+//   freed it and took the block back for something else
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "os.h"
+#include "ostimer.h"
+#include "ospool.h"
+#include "CortexM.h"
+#include "simport.h"
+
+#define TIMESLICE 80000            // 1 ms ticks
+#define TIMERS    2000
+#define POOLED    8                // one-shots from an OS_Pool
+#define REUSED    0x00             // fill of a reused block, maxExec reads 0
+
+OS_Timer_t Timer[TIMERS];
+uint32_t Due[TIMERS];              // tick the next callback is due
+uint32_t Period[TIMERS];           // 0 for one-shot
+uint32_t Armed[TIMERS];            // a callback is expected
+
+uint32_t Starts, Stops, Callbacks;
+uint32_t Early, Stale, MaxLate;
+
+OS_Pool_t TimerPool;
+OS_POOL_MEMORY(TimerMemory, sizeof(OS_Timer_t), POOLED);
+uint8_t *Parked[POOLED];           // reused blocks, checked by Pooler
+uint32_t NumParked, PooledRuns, Clobbered;
+
+// ******** Callback ************
+// In the timer daemon: check against the model, then a little work
+void Callback(void *arg){
+  uint32_t i = (uint32_t)arg;
+  long sr = StartCritical();
+  uint32_t now = (uint32_t)OS_TickCount();
+  if(!Armed[i]){
+    Stale++;
+  } else{
+    if((int32_t)(now - Due[i]) < 0){
+      Early++;
+    }
+    if(now - Due[i] > MaxLate){
+      MaxLate = now - Due[i];
+    }
+    if(Period[i]){                 // late periodic timers skip expiries
+      Due[i] += Period[i];
+      while((int32_t)(Due[i] - now) <= 0){
+        Due[i] += Period[i];
+      }
+    } else{
+      Armed[i] = 0;
+    }
+  }
+  Callbacks++;
+  EndCritical(sr);
+  Sim_Work(Sim_Range(20, 200));
+}
+
+// ******** Pooled ************
+// One-shot callback of a pooled timer: stop it, free it and take the
+// block straight back, the same one as the pool is LIFO, to fill it
+// as something that is not a timer
+void Pooled(void *arg){
+  OS_Timer_t *timer = arg;
+  Sim_Work(Sim_Range(100, 400));  // over 1 usec, so maxExec grows
+  OS_TimerStop(timer);
+  OS_PoolFree(&TimerPool, timer);
+  uint8_t *block = OS_PoolAlloc(&TimerPool);
+  memset(block, REUSED, sizeof(OS_Timer_t));
+  long sr = StartCritical();
+  Parked[NumParked++] = block;
+  PooledRuns++;
+  EndCritical(sr);
+}
+
+// ******** touch ************
+// Stop one random timer, or start it again with a new delay
+static void touch(void){
+  uint32_t i = Sim_Rand()%TIMERS;
+  long sr = StartCritical();
+  uint32_t r = Sim_Rand()%10;
+  if(r < 2){
+    OS_TimerStop(&Timer[i]);
+    Armed[i] = 0;
+    Stops++;
+  } else{
+    uint32_t delay = (r < 7) ? Sim_Range(0, 100) :
+                     (r < 9) ? Sim_Range(100, 9000) : Sim_Range(9000, 300000);
+    uint32_t period = ((Sim_Rand()%3) == 0) ? Sim_Range(1, 5000) : 0;
+    OS_TimerStart(&Timer[i], delay, period);
+    Due[i] = (uint32_t)OS_TickCount() + ((delay == 0) ? 1 : delay);
+    Period[i] = period;
+    Armed[i] = 1;
+    Starts++;
+  }
+  EndCritical(sr);
+}
+
+// ******** DeviceIsr ************
+// About every 375 us
+void DeviceIsr(void){
+  touch();
+}
+
+// ******** Toucher ************
+// Priority 2: bursts of up to 20 changes, then work and a sleep
+void Toucher(void *arg){
+  for(;;){
+    for(uint32_t k = Sim_Range(1, 20); k > 0; k--){
+      touch();
+    }
+    Sim_Work(Sim_Range(1000, 50000));
+    OS_Sleep(Sim_Range(0, 30));
+  }
+}
+
+// ******** Pooler ************
+// Priority 2: checks that nothing wrote into the reused blocks and
+// frees them, then starts a pooled timer in every free block
+void Pooler(void *arg){
+  for(;;){
+    long sr = StartCritical();
+    while(NumParked > 0){
+      uint8_t *block = Parked[--NumParked];
+      EndCritical(sr);
+      for(uint32_t k = 0; k < sizeof(OS_Timer_t); k++){
+        if(block[k] != REUSED){
+          Clobbered++;
+          break;
+        }
+      }
+      OS_PoolFree(&TimerPool, block);
+      sr = StartCritical();
+    }
+    EndCritical(sr);
+    OS_Timer_t *timer;
+    while((timer = OS_PoolAlloc(&TimerPool)) != NULL){
+      OS_TimerInit(timer, &Pooled, timer);
+      OS_TimerStart(timer, Sim_Range(0, 20), 0);
+    }
+    OS_Sleep(Sim_Range(1, 10));
+  }
+}
+
+// ******** Hog ************
+// Priority 3: up to 2.5 ms of work at a time
+void Hog(void *arg){
+  for(;;){
+    Sim_Work(Sim_Range(1000, 200000));
+    OS_Sleep(Sim_Range(1, 40));
+  }
+}
+
+// ******** Report ************
+// At the end of the simulated time
+int Report(void){
+  uint32_t now = (uint32_t)OS_TickCount();
+  uint32_t overdue = 0, runs = 0, statLate = 0;
+  for(uint32_t i = 0; i < TIMERS; i++){
+    OS_TimerStats_t stats;
+    if(Armed[i] && ((int32_t)(now - Due[i]) > 2)){
+      overdue++;
+    }
+    OS_TimerStats(&Timer[i], &stats);
+    runs += stats.runs;
+    if(stats.maxLate > statLate){
+      statLate = stats.maxLate;
+    }
+  }
+  uint32_t elapsed = (uint32_t)(Sim_Now()/TIMESLICE);
+  uint32_t drift = (now > elapsed) ? now - elapsed : elapsed - now;
+  uint32_t failed = Early || Stale || overdue || (runs != Callbacks) || (drift > 1) ||
+                    Clobbered || (PooledRuns == 0);
+  printf("%u ticks in %u ms, %u starts, %u stops, %u callbacks, %u counted\n",
+         now, elapsed, Starts, Stops, Callbacks, runs);
+  printf("%u pooled one-shots freed in their callback, %u blocks written after\n",
+         PooledRuns, Clobbered);
+  printf("%u early, %u stale, %u overdue, most ticks late %u (stats %u)  %s\n",
+         Early, Stale, overdue, MaxLate, statLate, failed ? "FAIL" : "ok");
+  return failed ? 1 : 0;
+}
+
+int main(void){
+  OS_Init();
+  for(uint32_t i = 0; i < TIMERS; i++){
+    OS_TimerInit(&Timer[i], &Callback, (void *)i);
+  }
+  OS_PoolInit(&TimerPool, TimerMemory, sizeof(OS_Timer_t), POOLED);
+  OS_TimerServiceStart(0);
+  OS_CreateThread(&Toucher, NULL, NULL, 256, 2);
+  OS_CreateThread(&Pooler, NULL, NULL, 256, 2);
+  OS_CreateThread(&Hog, NULL, NULL, 256, 3);
+  Sim_AddInterrupt(&DeviceIsr, 30000, 20000);
+  Sim_OnEnd(&Report);
+  OS_Launch(TIMESLICE);
+  return 0;                        // never reached
+}
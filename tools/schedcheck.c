@@ -0,0 +1,396 @@
+// schedcheck.c
+// Runs on the host (gcc -std=c99 -O2 -o schedcheck schedcheck.c -lm)
+// Offline schedulability check for the RTOS task set.
+// Reads a task table (see pong.tasks) describing the ISRs, periodic
+// events, EDF threads and priority threads with their measured WCETs,
+// then reports each one's worst-case response time and slack:
+//  - fixed priority: response-time analysis, R = C + B + sum ceil(R/Tj)*Cj
+//  - EDF: the kernel's admission bound plus the CPU left by ISRs and events
+//  - B: the longest section with the kernel masked. It delays every
+//    thread and event, but only the ISRs the mask holds off: all of
+//    them with PRIMASK, those at the ceiling and below with OS_BASEPRI
+// With -c it prints the OS_AddThreads/OS_AddPeriodicEventThread calls
+// for main() instead, so the table is the one place the task set lives.
+// Exit status is 1 if any task can miss its deadline.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAXTASKS 64
+#define EDFUTILIZATION 90    // percent, must match os.c
+
+typedef enum{ ISR, EVENT, EDF, THREAD } kind_t;
+
+typedef struct{
+  kind_t kind;
+  char name[32];
+  uint32_t priority;   // threads and ISRs (NVIC), 0 is highest
+  double period;       // us, 0 for a background thread
+  double deadline;     // us
+  double wcet;         // us, the budget for an EDF thread
+  double response;     // us, worst case found by the analysis
+} task_t;
+
+task_t Task[MAXTASKS];
+int NumTasks;
+double ClockMHz = 80;      // core clock
+uint32_t TickCycles = 10000; // OS_Launch time slice
+double TickUs;             // time slice in us
+double SysTickUs = 2;      // SysTick_Handler cost without events
+double SwitchUs = 1;       // one context switch
+double CriticalUs = 0;     // longest section with the kernel masked
+double PrimaskUs = 0;      // longest PRIMASK section with OS_BASEPRI
+uint32_t Ceiling = 0;      // OS_KERNELCEILING with OS_BASEPRI, 0 for PRIMASK
+int Deferred = 1;          // OS_DEFEREVENTS, events run in OS_EventThread
+
+// ******** Fail ************
+// Report a bad line of the task table and quit
+static void Fail(int line, const char *message){
+  fprintf(stderr, "line %d: %s\n", line, message);
+  exit(2);
+}
+
+// ******** Load ************
+// Read the task table, one directive per line, # starts a comment
+//   clock    <MHz>
+//   tick     <cycles>                          OS_Launch argument
+//   systick  <us>                              tick cost without events
+//   switch   <us>                              one context switch
+//   critical <us>                              longest kernel critical section
+//   ceiling  <priority>                        OS_KERNELCEILING with OS_BASEPRI,
+//                                              0 (the default) for PRIMASK
+//   primask  <us>                              longest section that still sets
+//                                              PRIMASK with OS_BASEPRI (BSP)
+//   defer    <0|1>                             OS_DEFEREVENTS
+//   isr      <name> <priority> <period us> <wcet us>
+//            NVIC priority; equal priorities in the order listed
+//   event    <name> <period us> <wcet us>      in OS_AddPeriodicEventThread order
+//   edf      <name> <period us> <deadline us> <budget us>
+//   thread   <name> <priority> <period us> <wcet us> [deadline us]
+//            period 0 is a background thread, listed but not analyzed
+static void Load(FILE *file){
+  char text[256], word[16];
+  int line = 0;
+  while(fgets(text, sizeof(text), file) != NULL){
+    line++;
+    char *hash = strchr(text, '#');
+    if(hash != NULL){
+      *hash = 0;
+    }
+    if(sscanf(text, "%15s", word) != 1){
+      continue;                          // blank or comment
+    }
+    task_t *t = &Task[NumTasks];
+    memset(t, 0, sizeof(*t));
+    int n;
+    if(strcmp(word, "clock") == 0){
+      if(sscanf(text, "%*s %lf", &ClockMHz) != 1) Fail(line, "clock <MHz>");
+      continue;
+    } else if(strcmp(word, "tick") == 0){
+      if(sscanf(text, "%*s %u", &TickCycles) != 1) Fail(line, "tick <cycles>");
+      continue;
+    } else if(strcmp(word, "systick") == 0){
+      if(sscanf(text, "%*s %lf", &SysTickUs) != 1) Fail(line, "systick <us>");
+      continue;
+    } else if(strcmp(word, "switch") == 0){
+      if(sscanf(text, "%*s %lf", &SwitchUs) != 1) Fail(line, "switch <us>");
+      continue;
+    } else if(strcmp(word, "critical") == 0){
+      if(sscanf(text, "%*s %lf", &CriticalUs) != 1) Fail(line, "critical <us>");
+      continue;
+    } else if(strcmp(word, "ceiling") == 0){
+      if((sscanf(text, "%*s %u", &Ceiling) != 1) || (Ceiling > 7)){
+        Fail(line, "ceiling <priority 0 to 7>");
+      }
+      continue;
+    } else if(strcmp(word, "primask") == 0){
+      if(sscanf(text, "%*s %lf", &PrimaskUs) != 1) Fail(line, "primask <us>");
+      continue;
+    } else if(strcmp(word, "defer") == 0){
+      if(sscanf(text, "%*s %d", &Deferred) != 1) Fail(line, "defer <0|1>");
+      continue;
+    }
+    if(NumTasks >= MAXTASKS){
+      Fail(line, "too many tasks");
+    }
+    if(strcmp(word, "isr") == 0){
+      t->kind = ISR;
+      n = sscanf(text, "%*s %31s %u %lf %lf", t->name, &t->priority, &t->period, &t->wcet);
+      if(n != 4) Fail(line, "isr <name> <priority> <period> <wcet>");
+      if(t->priority > 7) Fail(line, "priority must be 0 to 7");
+    } else if(strcmp(word, "event") == 0){
+      t->kind = EVENT;
+      n = sscanf(text, "%*s %31s %lf %lf", t->name, &t->period, &t->wcet);
+      if(n != 3) Fail(line, "event <name> <period> <wcet>");
+    } else if(strcmp(word, "edf") == 0){
+      t->kind = EDF;
+      n = sscanf(text, "%*s %31s %lf %lf %lf", t->name, &t->period, &t->deadline, &t->wcet);
+      if(n != 4) Fail(line, "edf <name> <period> <deadline> <budget>");
+      if((t->wcet > t->deadline) || (t->deadline > t->period)){
+        Fail(line, "edf needs budget <= deadline <= period");
+      }
+    } else if(strcmp(word, "thread") == 0){
+      t->kind = THREAD;
+      n = sscanf(text, "%*s %31s %u %lf %lf %lf", t->name, &t->priority,
+                 &t->period, &t->wcet, &t->deadline);
+      if(n < 4) Fail(line, "thread <name> <priority> <period> <wcet> [deadline]");
+      if(t->priority > 7) Fail(line, "priority must be 0 to 7");
+    } else{
+      Fail(line, "unknown directive");
+    }
+    if((t->kind != THREAD) && (t->period <= 0)){
+      Fail(line, "period must be positive");
+    }
+    if(t->deadline == 0){
+      t->deadline = t->period;
+    }
+    NumTasks++;
+  }
+  TickUs = TickCycles/ClockMHz;
+}
+
+// ******** SysTickCost ************
+// Worst-case SysTick_Handler run. Without OS_DEFEREVENTS every event
+// that is due runs inside it, with interrupts disabled
+static double SysTickCost(void){
+  double cost = SysTickUs;
+  if(!Deferred){
+    for(int i = 0; i < NumTasks; i++){
+      if(Task[i].kind == EVENT) cost += Task[i].wcet;
+    }
+  }
+  return cost;
+}
+
+// ******** Blocking ************
+// Longest time the kernel's mask holds off ISR i. SysTick runs with the
+// kernel masked, so it counts here; threads and events count SysTick
+// and the events as preemption instead. With OS_BASEPRI an ISR above
+// the ceiling waits only for the sections that still set PRIMASK
+static double Blocking(int i){
+  if((Ceiling > 0) && (Task[i].priority < Ceiling)){
+    return PrimaskUs;
+  }
+  double b = CriticalUs;
+  if(SysTickCost() > b){
+    b = SysTickCost();
+  }
+  if(PrimaskUs > b){
+    b = PrimaskUs;
+  }
+  return b;
+}
+
+// ******** Preempts ************
+// 1 if task j can delay task i once per release of j.
+// SysTick is handled separately as the lowest ISR, the events run
+// in it or in OS_EventThread, above every thread either way
+static int Preempts(int j, int i){
+  task_t *a = &Task[j], *b = &Task[i];
+  if(j == i) return 0;
+  if(a->kind == ISR) return (b->kind != ISR) || (a->priority < b->priority)
+                            || ((a->priority == b->priority) && (j < i));
+  if(b->kind == ISR) return 0;
+  if(a->kind == EVENT) return (b->kind != EVENT) || (j < i);
+  if(b->kind == EVENT) return 0;
+  if(a->kind == EDF) return b->kind == THREAD;
+  if(b->kind == EDF) return 0;
+  if(a->period == 0) return 0;       // background threads only fill idle time
+  // equal priorities round-robin, so a peer can run first as well
+  return a->priority <= b->priority;
+}
+
+// ******** Cost ************
+// Execution charged per release, threads pay a switch in and out
+static double Cost(int i){
+  if((Task[i].kind == EDF) || (Task[i].kind == THREAD)){
+    return Task[i].wcet + 2*SwitchUs;
+  }
+  return Task[i].wcet;
+}
+
+// ******** Response ************
+// Fixed-priority response-time analysis for task i: iterate
+// R = C + B + sum over higher tasks of ceil(R/Tj)*Cj until it
+// settles or passes the deadline
+// Inputs:  task index
+//          c, execution time of the task itself
+//          b, blocking by lower work that cannot be preempted
+// Outputs: worst-case response time in us, > deadline on a miss
+static double Response(int i, double c, double b){
+  double r = c + b, last;
+  do{
+    last = r;
+    r = c + b;
+    if(Task[i].kind != ISR){     // ISRs outrank SysTick, it only blocks them
+      r += ceil(last/TickUs)*SysTickUs;
+    }
+    for(int j = 0; j < NumTasks; j++){
+      if(Preempts(j, i)){
+        r += ceil(last/Task[j].period)*Cost(j);
+      }
+    }
+  } while((r != last) && (r <= Task[i].deadline));
+  return r;
+}
+
+// ******** Analyze ************
+// Fill in every task's response time and print the report
+// Outputs: number of tasks that can miss their deadline
+static int Analyze(void){
+  double busy = SysTickUs/TickUs;      // utilization of everything periodic
+  double above = busy;                 // utilization above the EDF threads
+  double density = 0;                  // sum of budget/deadline over EDF threads
+  int misses = 0;
+  for(int i = 0; i < NumTasks; i++){
+    task_t *t = &Task[i];
+    if(t->period == 0) continue;
+    busy += Cost(i)/t->period;
+    if((t->kind == ISR) || (t->kind == EVENT)){
+      above += Cost(i)/t->period;
+    }
+    if(t->kind == EDF){
+      density += Cost(i)/t->deadline;
+    }
+  }
+  printf("time slice %.1f us, SysTick %.1f us, kernel masked up to %.1f us",
+         TickUs, SysTickCost(), (SysTickCost() > CriticalUs) ? SysTickCost() : CriticalUs);
+  if(Ceiling > 0){
+    printf(" at priority %u and below, PRIMASK %.1f us\n", Ceiling, PrimaskUs);
+  } else{
+    printf(" with PRIMASK\n");
+  }
+  printf("%-20s %-6s %4s %10s %10s %10s %10s %10s\n",
+         "task", "class", "prio", "period", "wcet", "deadline", "response", "slack");
+  for(int i = 0; i < NumTasks; i++){
+    task_t *t = &Task[i];
+    const char *kind = "";
+    double lower = 0;                  // longest non-preemptive lower event
+    switch(t->kind){
+    case ISR:
+      kind = "isr";
+      t->response = Response(i, Cost(i), Blocking(i));
+      break;
+    case EVENT:
+      kind = "event";
+      for(int j = i + 1; j < NumTasks; j++){
+        if((Task[j].kind == EVENT) && (Task[j].wcet > lower)) lower = Task[j].wcet;
+      }
+      if(Deferred){
+        // released at the first tick after its release time, then
+        // waits for an event already running and for the ones before it
+        t->response = TickUs + Response(i, Cost(i), CriticalUs + lower);
+      } else{
+        // runs inside SysTick with interrupts disabled, so nothing
+        // preempts it once the tick starts
+        t->response = TickUs + CriticalUs + SysTickCost();
+      }
+      break;
+    case EDF:
+      kind = "edf";
+      // EDF meets every deadline while the demand fits in what the
+      // ISRs and events leave, so the bound is the deadline itself
+      t->response = ((density <= EDFUTILIZATION/100.0) && (density + above <= 1))
+                    ? t->deadline : INFINITY;
+      break;
+    case THREAD:
+      kind = "thread";
+      if(t->period == 0){
+        printf("%-20s %-6s %4u %10s %10.1f %10s %10s %10s\n",
+               t->name, kind, t->priority, "-", t->wcet, "-", "-", "background");
+        continue;
+      }
+      t->response = Response(i, Cost(i), CriticalUs);
+      break;
+    }
+    char prio[8] = "-";
+    if((t->kind == ISR) || (t->kind == THREAD)){
+      snprintf(prio, sizeof(prio), "%u", t->priority);
+    }
+    if(t->response > t->deadline){
+      misses++;
+      printf("%-20s %-6s %4s %10.1f %10.1f %10.1f %10s %10s\n",
+             t->name, kind, prio, t->period, t->wcet, t->deadline, "> deadline", "MISS");
+    } else{
+      printf("%-20s %-6s %4s %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+             t->name, kind, prio, t->period, t->wcet, t->deadline, t->response,
+             t->deadline - t->response);
+    }
+  }
+  printf("CPU utilization %.1f%%\n", 100*busy);
+  if(density > 0){
+    printf("EDF density %.1f%% (admission limit %d%%, %.1f%% left by ISRs and events)\n",
+           100*density, EDFUTILIZATION, 100*(1 - above));
+  }
+  printf("%s\n", misses ? "NOT SCHEDULABLE" : "schedulable");
+  return misses;
+}
+
+// ******** Ticks ************
+// Convert us to whole ticks, up for budgets and down for periods
+static uint32_t Ticks(double us, int roundUp){
+  double ticks = us/TickUs;
+  return (uint32_t)(roundUp ? ceil(ticks) : floor(ticks));
+}
+
+// ******** Generate ************
+// Print the registration code for main(), after OS_Init
+static void Generate(void){
+  int slot = 0;
+  for(int i = 0; i < NumTasks; i++){
+    if(Task[i].kind != THREAD) continue;
+    if(slot == 0) printf("  OS_AddThreads(");
+    printf("%s&%s,%u", slot ? ", " : "", Task[i].name, Task[i].priority);
+    if(++slot == 6){
+      printf(");\n");
+      slot = 0;
+    }
+  }
+  if(slot){
+    for(; slot < 6; slot++) printf(", NULL,0");
+    printf(");\n");
+  }
+  for(int i = 0; i < NumTasks; i++){
+    task_t *t = &Task[i];
+    if(t->kind == EVENT){
+      uint32_t us = (uint32_t)t->period;
+      if(us%1000 == 0){
+        printf("  OS_AddPeriodicEventThread(&%s, %u);\n", t->name, us/1000);
+      } else{
+        printf("  OS_AddPeriodicEventUs(&%s, %u);\n", t->name, us);
+      }
+    } else if(t->kind == EDF){
+      printf("  OS_CreateEdfThread(&%s, NULL, NULL, 512, %u, %u, %u);\n", t->name,
+             Ticks(t->period, 0), Ticks(t->deadline, 0), Ticks(t->wcet, 1));
+    }
+  }
+  printf("  OS_Launch(%u);\n", TickCycles);
+}
+
+int main(int argc, char **argv){
+  int code = 0;
+  if((argc > 1) && (strcmp(argv[1], "-c") == 0)){
+    code = 1;
+    argc--;
+    argv++;
+  }
+  if(argc != 2){
+    fprintf(stderr, "usage: schedcheck [-c] tasks\n");
+    return 2;
+  }
+  FILE *file = fopen(argv[1], "r");
+  if(file == NULL){
+    perror(argv[1]);
+    return 2;
+  }
+  Load(file);
+  fclose(file);
+  if(code){
+    Generate();
+    return 0;
+  }
+  return Analyze() ? 1 : 0;
+}
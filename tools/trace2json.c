@@ -0,0 +1,196 @@
+// trace2json.c
+// Runs on the host (gcc -std=c99 -O2 -o trace2json trace2json.c)
+// Turns OS_TraceDump output captured from UART0 into Chrome trace
+// JSON, which chrome://tracing and ui.perfetto.dev both open.
+//   trace2json dump.bin > trace.json
+// Threads, periodic events and interrupts each get a track. Semaphore
+// waits and signals, releases and OS_TraceMark records are instant
+// events. Several dumps in one file are decoded one after the other;
+// the 32-bit cycle stamps are unwrapped as long as consecutive
+// records are less than 2^32 cycles (53 s at 80 MHz) apart.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// must match ostrace.h
+#define OS_TRACE_SWITCH   1
+#define OS_TRACE_WAIT     2
+#define OS_TRACE_SIGNAL   3
+#define OS_TRACE_RELEASE  4
+#define OS_TRACE_EVENTRUN 5
+#define OS_TRACE_EVENTEND 6
+#define OS_TRACE_ISRENTER 7
+#define OS_TRACE_ISREXIT  8
+#define OS_TRACE_MARK     9
+#define OS_TRACE_IDLE   0xFF
+#define OS_TRACE_EVENTS 0xFE
+
+#define PID_THREADS 1
+#define PID_EVENTS  2
+#define PID_ISRS    3
+
+int First = 1;               // no comma before the first JSON event
+uint8_t Named[4][256];       // track already has a name
+uint32_t Open[4][256];       // B events on a track still waiting for their E
+
+// ******** readWord ************
+// Read 32 bits, least significant byte first
+// Outputs: 1 if successful, 0 at the end of the file
+static int readWord(FILE *in, uint32_t *word){
+  uint8_t b[4];
+  if(fread(b, 1, 4, in) != 4){
+    return 0;
+  }
+  *word = b[0] | (b[1]<<8) | (b[2]<<16) | ((uint32_t)b[3]<<24);
+  return 1;
+}
+
+// ******** emit ************
+// Start one JSON event, the caller prints the rest and the closing brace
+static void emit(const char *phase, int pid, int tid, double us){
+  printf("%s\n{\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+         First ? "" : ",", phase, pid, tid, us);
+  First = 0;
+}
+
+// ******** slice ************
+// Begin or end a slice on a track. An end whose begin was overwritten
+// before the dump is dropped, the viewers reject it otherwise
+static void slice(int begin, int pid, int tid, double us, const char *text){
+  if(begin){
+    Open[pid][tid]++;
+  } else if(Open[pid][tid] == 0){
+    return;
+  } else{
+    Open[pid][tid]--;
+  }
+  emit(begin ? "B" : "E", pid, tid, us);
+  printf(",\"name\":\"%s\"}", text);
+}
+
+// ******** name ************
+// Name a track the first time it is used
+static void name(int pid, int tid){
+  char text[32];
+  if(Named[pid][tid]){
+    return;
+  }
+  Named[pid][tid] = 1;
+  if(pid == PID_THREADS){
+    if(tid == OS_TRACE_IDLE) strcpy(text, "idle");
+    else if(tid == OS_TRACE_EVENTS) strcpy(text, "OS_EventThread");
+    else sprintf(text, "thread %d", tid);
+  } else if(pid == PID_EVENTS){
+    sprintf(text, "periodic event %d", tid);
+  } else if(tid == 15){
+    strcpy(text, "SysTick");
+  } else{
+    sprintf(text, "IRQ %d", tid - 16);
+  }
+  emit("M", pid, tid, 0);
+  printf(",\"name\":\"thread_name\",\"args\":{\"name\":\"%s\"}}", text);
+}
+
+int main(int argc, char **argv){
+  FILE *in = stdin;
+  if(argc > 1){
+    in = fopen(argv[1], "rb");
+    if(in == NULL){
+      perror(argv[1]);
+      return 1;
+    }
+  }
+  uint64_t cycles = 0;       // unwrapped time of the last record
+  uint32_t last = 0;
+  int started = 0;
+  int running = -1;          // thread on the CPU, -1 before the first switch
+  double runStart = 0;
+  double lastCyclesPerUs = 1;
+  char magic[4];
+  printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  emit("M", PID_THREADS, 0, 0);
+  printf(",\"name\":\"process_name\",\"args\":{\"name\":\"threads\"}}");
+  emit("M", PID_EVENTS, 0, 0);
+  printf(",\"name\":\"process_name\",\"args\":{\"name\":\"periodic events\"}}");
+  emit("M", PID_ISRS, 0, 0);
+  printf(",\"name\":\"process_name\",\"args\":{\"name\":\"interrupts\"}}");
+  while(fread(magic, 1, 4, in) == 4){
+    uint32_t clock, count, lost;
+    if((memcmp(magic, "TRC1", 4) != 0) || !readWord(in, &clock) ||
+       !readWord(in, &count) || !readWord(in, &lost) || (clock == 0)){
+      fprintf(stderr, "not an OS_TraceDump header\n");
+      return 1;
+    }
+    if(lost){
+      fprintf(stderr, "%u records were overwritten before this dump\n", lost);
+    }
+    double cyclesPerUs = clock/1e6;
+    lastCyclesPerUs = cyclesPerUs;
+    for(uint32_t i = 0; i < count; i++){
+      uint32_t time, info;
+      if(!readWord(in, &time) || !readWord(in, &info)){
+        fprintf(stderr, "dump ends early\n");
+        return 1;
+      }
+      if(started){
+        cycles += (uint32_t)(time - last);
+      }
+      started = 1;
+      last = time;
+      double us = cycles/cyclesPerUs;
+      int type = info&0xFF;
+      int id = (info>>8)&0xFF;
+      uint32_t arg = info>>16;
+      switch(type){
+      case OS_TRACE_SWITCH:
+        if(id == running) break;   // PendSV kept the same thread
+        if(running >= 0){
+          name(PID_THREADS, running);
+          emit("X", PID_THREADS, running, runStart);
+          printf(",\"dur\":%.3f,\"name\":\"running\"}", us - runStart);
+        }
+        running = id;
+        runStart = us;
+        break;
+      case OS_TRACE_WAIT:
+      case OS_TRACE_SIGNAL:
+        name(PID_THREADS, id);
+        emit("i", PID_THREADS, id, us);
+        printf(",\"s\":\"t\",\"name\":\"%s 0x%08X\"}",
+               (type == OS_TRACE_WAIT) ? "wait" : "signal", 0x20000000u | (arg<<2));
+        break;
+      case OS_TRACE_RELEASE:
+        name(PID_EVENTS, id);
+        emit("i", PID_EVENTS, id, us);
+        printf(",\"s\":\"t\",\"name\":\"release\"}");
+        break;
+      case OS_TRACE_EVENTRUN:
+      case OS_TRACE_EVENTEND:
+        name(PID_EVENTS, id);
+        slice(type == OS_TRACE_EVENTRUN, PID_EVENTS, id, us, "run");
+        break;
+      case OS_TRACE_ISRENTER:
+      case OS_TRACE_ISREXIT:
+        name(PID_ISRS, id);
+        slice(type == OS_TRACE_ISRENTER, PID_ISRS, id, us, "handler");
+        break;
+      case OS_TRACE_MARK:
+        name(PID_THREADS, (running >= 0) ? running : 0);
+        emit("i", PID_THREADS, (running >= 0) ? running : 0, us);
+        printf(",\"s\":\"t\",\"name\":\"mark %d\",\"args\":{\"arg\":%u}}", id, arg);
+        break;
+      default:
+        fprintf(stderr, "record %u has unknown type %d\n", i, type);
+        break;
+      }
+    }
+  }
+  if(running >= 0){            // still running at the end of the dump
+    name(PID_THREADS, running);
+    emit("X", PID_THREADS, running, runStart);
+    printf(",\"dur\":%.3f,\"name\":\"running\"}", cycles/lastCyclesPerUs - runStart);
+  }
+  printf("\n]}\n");
+  return 0;
+}